@@ -0,0 +1,23 @@
+#ifndef _CORE_HOST_H_
+#define _CORE_HOST_H_
+
+/**
+ * Host build, HAL_HOST defined: bus level drivers (e.g. hal_spi_flash.c) are
+ * compiled natively and linked against simulated peripherals, see test/host.
+ * Register structures are shared with the target core, no register is mapped.
+ */
+
+#include <stdint.h>
+
+#ifndef _BV
+	#define _BV(bit) (1 << (bit))
+#endif
+
+/* Host tests are single threaded, IRQs are delivered by the simulation */
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type) for(uint8_t __atomic_once = 1; __atomic_once; __atomic_once = 0)
+
+#include "mega2560.h"
+
+#endif /* _CORE_HOST_H_ */
\ No newline at end of file
@@ -1,7 +1,9 @@
 #ifndef _CORE_ATMEGA2560_H_
 #define _CORE_ATMEGA2560_H_
 
+#ifndef HAL_HOST
 #include <avr/io.h>
+#endif
 #include <stdint.h>
 
 /** @addtogroup Peripheral_registers_structures
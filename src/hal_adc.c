@@ -7,9 +7,18 @@
  *             ++ Initialization and Configuration of ADC
  *           + Operation functions
  *             ++ Start Conversion
+ *             ++ Noise reduction sleep conversion
+ *             ++ Timer triggered conversions
+ *             ++ Fast 8-bit capture
  *           + Control functions
  *             ++ Channel slot configuration
  *             ++ Select channel slot and switch ADC MUX
+ *             ++ MUX and reference settling
+ *             ++ VCC measurement and slot calibration
+ *             ++ Scan sequencer
+ *             ++ Ring buffer streaming
+ *             ++ Slot result filters
+ *             ++ Analog watchdog
  *           + State functions
  *             ++ ADC state machine management
  *             ++ Interrupts and flags management
@@ -20,23 +29,419 @@
  */
 
 #include "hal_adc.h"
+#include <avr/sleep.h>
+#include <avr/eeprom.h>
+
+
+/* PRIVATE FUNCTIONS */
+static uint8_t ADC_SetMux(adc_handler_t *handler, uint8_t Channel);
+static void ADC_SetDiscard(adc_handler_t *handler, uint8_t Count);
+static void ADC_DropInFlight(adc_handler_t *handler);
+static uint8_t ADC_ChannelPins(uint8_t Channel);
+static uint8_t ADC_IsFreeRunning(adc_handler_t *handler);
+static void ADC_SequenceNext(adc_handler_t *handler);
+static uint8_t ADC_PublishResult(adc_handler_t *handler, uint8_t SlotId, uint16_t result);
+static void ADC_ClearTriggerFlag(adc_handler_t *handler);
+static uint16_t ADC_Filter(volatile adc_slot_t *slot, uint16_t x);
+static void ADC_Watchdog(adc_handler_t *handler, uint8_t SlotId);
+static void ADC_UpdateScale(adc_handler_t *handler, uint8_t SlotId);
+static void ADC_UpdateScaleAll(adc_handler_t *handler);
+static void ADC_UpdateVcc(adc_handler_t *handler);
+static void ADC_RestoreConfig(adc_handler_t *handler);
+/* END OF PRIVATE FUNCTIONS */
 
 
 void ADC_IRQHandler(adc_handler_t *handler){
+	uint8_t *fast = handler->FastBuf;
+
+	if(fast != NULL){
+		// left aligned, ADCH is the high byte of ADC_REG
+		uint16_t idx = handler->FastIndex;
+		fast[idx++] = ((volatile uint8_t *)&handler->Instance->ADC_REG)[1];
+		handler->FastIndex = idx;
+
+		if(idx == handler->FastLength){
+			handler->FastBuf = NULL;
+			ADC_RestoreConfig(handler);
+			handler->InCalibration = 1; // conversion in flight belongs to the capture
+			if(handler->CaptureCpltCallback != NULL){
+				handler->CaptureCpltCallback(handler, fast, idx);
+			}
+		}
+		return;
+	}
+
 	uint16_t result = handler->Instance->ADC_REG;
+
+	ADC_ClearTriggerFlag(handler);
+
+	if(handler->SeqRunning){
+		uint8_t pos = handler->SeqCur;
+		ADC_SequenceNext(handler);
+
+		if(handler->InCalibration){
+			handler->InCalibration = 0; // Drop result
+		}
+		else if(handler->Discard){
+			handler->Discard--;
+		}
+		else if(pos != ADC_SEQ_NONE){
+			if(ADC_PublishResult(handler, handler->Sequence[pos], result) && !(handler->SeqFresh[pos >> 3] & _BV(pos & 0x07))){
+				handler->SeqFresh[pos >> 3] |= _BV(pos & 0x07);
+				handler->SeqFreshCount++;
+			}
+
+			// an oversampling slot publishes once every 4^n scans
+			if(pos == handler->SeqLength - 1 && handler->SeqFreshCount == handler->SeqLength){
+				for(uint8_t i = 0; i < sizeof(handler->SeqFresh); i++){
+					handler->SeqFresh[i] = 0;
+				}
+				handler->SeqFreshCount = 0;
+				if(handler->ScanCpltCallback != NULL)
+					handler->ScanCpltCallback(handler);
+			}
+		}
+		return;
+	}
+
 	handler->State = ADC_STATE_READY;
 	
 	if(handler->InCalibration){
 		handler->InCalibration = 0; // Drop result
 	}
+	else if(handler->Discard){
+		handler->Discard--;
+		if(handler->Init.AutoTrigState == ADC_AUTO_TRIG_OFF && !handler->SleepConv){
+			// single conversion: settle and convert again
+			handler->State = ADC_STATE_BUSY;
+			handler->Instance->ADCSRA_REG |= _BV(ADSC);
+		}
+	}
 	else{
-		handler->ChannelSlot[handler->SlotId].ConvResult = result;
-		handler->ChannelSlot[handler->SlotId].NewResultFlag = 1;
+		ADC_PublishResult(handler, handler->SlotId, result);
+	}
+}
+
+static uint8_t ADC_PublishResult(adc_handler_t *handler, uint8_t SlotId, uint16_t result){
+	volatile adc_slot_t *slot = &handler->ChannelSlot[SlotId];
+
+	if(handler->StreamBuf != NULL){
+		// raw conversions, in sequence order when the sequencer runs
+		uint16_t idx = handler->StreamIndex;
+		handler->StreamBuf[idx++] = result;
 
-		if(handler->ConvCpltCallback != NULL){
-			handler->ConvCpltCallback(handler, handler->SlotId);
+		if(idx == (handler->StreamLength >> 1)){
+			if(handler->StreamHalfCallback != NULL)
+				handler->StreamHalfCallback(handler, handler->StreamBuf, idx);
 		}
+		else if(idx == handler->StreamLength){
+			idx = 0;
+			if(handler->StreamFullCallback != NULL)
+				handler->StreamFullCallback(handler, &handler->StreamBuf[handler->StreamLength >> 1], handler->StreamLength >> 1);
+		}
+		handler->StreamIndex = idx;
+	}
+
+	if(slot->Oversample){
+		// sum 4^n samples, the sum shifted right by n keeps n extra bits
+		slot->Accum += result;
+		if(++slot->AccumCount < (1U << (slot->Oversample << 1))){
+			return 0;
+		}
+		result = (uint16_t)(slot->Accum >> slot->Oversample);
+		slot->Accum = 0;
+		slot->AccumCount = 0;
+	}
+
+	slot->ConvResult = result;
+	slot->FiltResult = (slot->Filter != ADC_FILTER_NONE) ? ADC_Filter(slot, result) : result;
+
+	if(SlotId == handler->VccSlot && handler->Init.Reference == ADC_REF_AVCC && slot->FiltResult){
+		// division and rescale are left to ADC_UpdateVcc, outside the IRQ
+		handler->VccDirty = 1;
+	}
+	slot->NewResultFlag = 1;
+
+	if(slot->WdgEnable){
+		ADC_Watchdog(handler, SlotId);
+	}
+
+	if(handler->ConvCpltCallback != NULL){
+		handler->ConvCpltCallback(handler, SlotId);
+	}
+	return 1;
+}
+
+static uint8_t ADC_SetMux(adc_handler_t *handler, uint8_t Channel){
+	if(Channel == handler->MuxChannel){
+		return 0;
+	}
+	// Channel bits 4:0 are MUX4:0 and bit 5 is MUX5 (ADCSRB)
+	handler->Instance->ADMUX_REG = (handler->Instance->ADMUX_REG & ~(0x1F)) | (Channel & 0x1F);
+	handler->Instance->ADCSRB_REG = (handler->Instance->ADCSRB_REG & ~_BV(MUX5)) | ((Channel & 0x20) ? _BV(MUX5) : 0x00);
+	handler->MuxChannel = Channel;
+	return 1;
+}
+
+static void ADC_SetDiscard(adc_handler_t *handler, uint8_t Count){
+	/*
+	 *	MUX and reference are latched when a conversion starts. A conversion
+	 *	running, or done with its IRQ still pending, used the previous
+	 *	settings: drop it too. Called with interrupts disabled.
+	**/
+	if(handler->Instance->ADCSRA_REG & _BV(ADSC)){
+		Count++;
+	}
+	if(handler->Instance->ADCSRA_REG & _BV(ADIF)){
+		Count++;
+	}
+	if(Count > handler->Discard){
+		handler->Discard = Count;
+	}
+}
+
+static void ADC_DropInFlight(adc_handler_t *handler){
+	/*
+	 *	Sequencer stopped: conversions running or pending (up to two in free
+	 *	running mode) belong to slots not tracked anymore. Without auto trigger
+	 *	there is one at most, InCalibration drops it without the restart a
+	 *	settling discard does. Called with interrupts disabled.
+	**/
+	if(handler->Init.AutoTrigState == ADC_AUTO_TRIG_OFF){
+		handler->InCalibration = (handler->Instance->ADCSRA_REG & (_BV(ADSC) | _BV(ADIF))) ? 1 : 0;
+	}
+	else {
+		ADC_SetDiscard(handler, 0);
 	}
+	handler->State = (handler->InCalibration || handler->Discard) ? ADC_STATE_BUSY : ADC_STATE_READY;
+}
+
+static uint8_t ADC_ChannelPins(uint8_t Channel){
+	// ADC pins used by a MUX value, bit n = ADCn (or ADC8+n when MUX5 is set)
+	static const uint8_t gain_pins[8] = {
+		_BV(0), _BV(1) | _BV(0), _BV(0), _BV(1) | _BV(0),
+		_BV(2), _BV(3) | _BV(2), _BV(2), _BV(3) | _BV(2)
+	};
+	uint8_t mux = Channel & 0x1F;
+
+	if(mux < 0x08)
+		return _BV(mux);
+	if(mux < 0x10)
+		return gain_pins[mux - 0x08];
+	if(mux < 0x18)
+		return _BV(mux - 0x10) | _BV(1);
+	if(mux < 0x1E)
+		return _BV(mux - 0x18) | _BV(2);
+	return 0; // 1.1V and GND
+}
+
+static uint8_t ADC_IsFreeRunning(adc_handler_t *handler){
+	return (handler->Init.AutoTrigState == ADC_AUTO_TRIG_ON && handler->Init.AutoTrigMode == ADC_TRIG_FREERUN);
+}
+
+static void ADC_SequenceNext(adc_handler_t *handler){
+	/*
+	 *	The MUX is latched when a conversion starts. In free running mode the
+	 *	next conversion is already running when the IRQ fires, so a MUX written
+	 *	here only applies to the one after it: the pipeline is two deep.
+	 *	Otherwise next conversion starts after the IRQ (ADSC or trigger event).
+	**/
+	uint8_t entry = ADC_SEQ_NONE;
+
+	if(handler->SeqSettle){
+		handler->SeqSettle--; // settling conversion, same MUX
+	}
+	else {
+		volatile adc_slot_t *slot;
+
+		handler->SlotId = handler->Sequence[handler->SeqPos];
+		slot = &handler->ChannelSlot[handler->SlotId];
+		if(ADC_SetMux(handler, slot->Channel) && slot->Settle){
+			handler->SeqSettle = slot->Settle - 1; // this conversion is the first one
+		}
+		else {
+			entry = handler->SeqPos;
+			if(++handler->SeqPos >= handler->SeqLength){
+				handler->SeqPos = 0;
+			}
+		}
+	}
+
+	if(ADC_IsFreeRunning(handler)){
+		handler->SeqCur = handler->SeqNext;
+		handler->SeqNext = entry;
+	}
+	else {
+		handler->SeqCur = entry;
+	}
+
+	if(handler->Init.AutoTrigState == ADC_AUTO_TRIG_OFF){
+		handler->Instance->ADCSRA_REG |= _BV(ADSC);
+	}
+}
+
+static uint16_t ADC_Filter(volatile adc_slot_t *slot, uint16_t x){
+	adc_filter_state_t *state = slot->FilterState;
+	uint8_t shift = slot->FilterShift;
+	uint32_t acc = state->Acc;
+
+	switch(slot->Filter){
+		case ADC_FILTER_EMA:
+			// acc holds y * 2^shift, keeps the fractional part
+			if(!state->Fill){
+				acc = (uint32_t)x << shift;
+			}
+			else {
+				acc = acc + x - (acc >> shift);
+			}
+			state->Fill = 1;
+			state->Acc = acc;
+			return (uint16_t)(acc >> shift);
+
+		case ADC_FILTER_BOXCAR: {
+			uint8_t idx = state->Index;
+			uint8_t len = 1 << shift;
+
+			if(!state->Fill){
+				for(uint8_t i = 0; i < len; i++){
+					state->Hist[i] = x;
+				}
+				acc = (uint32_t)x << shift;
+				state->Fill = 1;
+			}
+			else {
+				acc = acc + x - state->Hist[idx];
+				state->Hist[idx] = x;
+			}
+			state->Index = (idx + 1) & (len - 1);
+			state->Acc = acc;
+			return (uint16_t)(acc >> shift);
+		}
+
+		case ADC_FILTER_MEDIAN3: {
+			uint16_t a, b;
+
+			if(!state->Fill){
+				state->Hist[0] = x;
+				state->Hist[1] = x;
+				state->Fill = 1;
+			}
+			a = state->Hist[0];
+			b = state->Hist[1];
+			state->Hist[0] = b;
+			state->Hist[1] = x;
+
+			if(a > b){
+				uint16_t t = a; a = b; b = t;
+			}
+			// a <= b: median is b clamped to x, or a if x is below it
+			return (x < a) ? a : (x > b) ? b : x;
+		}
+
+		default:
+			return x;
+	}
+}
+
+static void ADC_Watchdog(adc_handler_t *handler, uint8_t SlotId){
+	volatile adc_slot_t *slot = &handler->ChannelSlot[SlotId];
+	uint16_t x = slot->FiltResult;
+	adc_wdg_zone_t zone = slot->WdgZone;
+
+	if(x < slot->WdgLow){
+		zone = ADC_WDG_BELOW;
+	}
+	else if(x > slot->WdgHigh){
+		zone = ADC_WDG_ABOVE;
+	}
+	else if((zone != ADC_WDG_BELOW || x - slot->WdgLow >= slot->WdgHyst) &&
+			(zone != ADC_WDG_ABOVE || slot->WdgHigh - x >= slot->WdgHyst)){
+		zone = ADC_WDG_INSIDE;
+	}
+
+	if(zone != slot->WdgZone){
+		slot->WdgZone = zone;
+		if(handler->WdgCallback != NULL){
+			handler->WdgCallback(handler, SlotId, zone);
+		}
+	}
+}
+
+static void ADC_ClearTriggerFlag(adc_handler_t *handler){
+	/*
+	 *	Conversions start on the rising edge of the trigger flag, a timer flag
+	 *	left set blocks every following trigger. Timer IRQ clears it by itself,
+	 *	otherwise it is cleared here. Flag and IRQ mask bits share positions.
+	**/
+	uint8_t id, bit;
+
+	if(handler->Init.AutoTrigState == ADC_AUTO_TRIG_OFF){
+		return;
+	}
+	switch(handler->Init.AutoTrigMode){
+		case ADC_TRIG_TIM0_COMP_A: id = 0; bit = OCF0A; break;
+		case ADC_TRIG_TIM0_OVF: id = 0; bit = TOV0; break;
+		case ADC_TRIG_TIM1_COMP_B: id = 1; bit = OCF1B; break;
+		case ADC_TRIG_TIM1_OVF: id = 1; bit = TOV1; break;
+		case ADC_TRIG_TIM1_INPUT_COMP: id = 1; bit = ICF1; break;
+		default: return;
+	}
+	if(!(TIM_INT_MASK->TIMSK_REG[id] & _BV(bit))){
+		TIM_INT_FLAG->TIFR_REG[id] = _BV(bit);
+	}
+}
+
+static void ADC_UpdateScale(adc_handler_t *handler, uint8_t SlotId){
+	/*
+	 *	mV = x * Gain / 2^15 * Vref / 2^bits = (x * Scale) >> 16,
+	 *	Scale = Gain * Vref >> (bits - 1). x * Scale stays below 2 * Gain * Vref.
+	**/
+	volatile adc_slot_t *slot = &handler->ChannelSlot[SlotId];
+	uint16_t vref;
+
+	switch(handler->Init.Reference){
+		case ADC_REF_AVCC: vref = handler->VccMv; break;
+		case ADC_REF_1V1: vref = handler->BandgapMv; break;
+		case ADC_REF_2V56: vref = 2560; break;
+		default: vref = ADC_AREF_MV; break;
+	}
+	slot->Scale = ((uint32_t)slot->Gain * vref) >> (9 + slot->Oversample);
+}
+
+static void ADC_UpdateScaleAll(adc_handler_t *handler){
+	for(uint8_t i = 0; i < ADC_SLOTS_SIZE; i++){
+		if(handler->ChannelSlot[i].Gain)
+			ADC_UpdateScale(handler, i);
+	}
+}
+
+static void ADC_UpdateVcc(adc_handler_t *handler){
+	uint16_t result = 0;
+	uint8_t bits = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->VccDirty && handler->VccSlot != ADC_SLOT_NONE){
+			result = handler->ChannelSlot[handler->VccSlot].FiltResult;
+			bits = 10 + handler->ChannelSlot[handler->VccSlot].Oversample;
+		}
+		handler->VccDirty = 0;
+	}
+	if(result == 0){
+		return;
+	}
+
+	// result = 1.1V * 2^bits / VCC
+	uint16_t vcc = (uint16_t)(((uint32_t)handler->BandgapMv << bits) / result);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		handler->VccMv = vcc;
+		ADC_UpdateScaleAll(handler);
+	}
+}
+
+static void ADC_RestoreConfig(adc_handler_t *handler){
+	handler->Instance->ADMUX_REG = (handler->Instance->ADMUX_REG & ~_BV(ADLAR)) | (handler->Init.DataAlign << ADLAR);
+	handler->Instance->ADCSRB_REG = (handler->Instance->ADCSRB_REG & ~(0x07)) | handler->Init.AutoTrigMode;
+	handler->Instance->ADCSRA_REG = _BV(ADEN) | (handler->Init.AutoTrigState << ADATE) | _BV(ADIE) | handler->Init.ClockPrescaler;
 }
 
 hal_status_t ADC_Init(adc_handler_t *handler){
@@ -46,6 +451,13 @@ hal_status_t ADC_Init(adc_handler_t *handler){
 	handler->Instance->ADMUX_REG = (handler->Init.Reference << REFS0) | (handler->Init.DataAlign << ADLAR);
 	handler->Instance->ADCSRA_REG = _BV(ADEN) | (handler->Init.AutoTrigState << ADATE) | _BV(ADIE) | handler->Init.ClockPrescaler;
 	handler->SlotId = 0;
+	handler->MuxChannel = ADC_CH0;
+	handler->Discard = 0;
+	handler->SleepConv = 0;
+	handler->VccSlot = ADC_SLOT_NONE;
+	handler->BandgapMv = ADC_BANDGAP_MV;
+	handler->VccMv = ADC_VCC_DEFAULT_MV;
+	handler->SeqRunning = 0;
 	handler->State = ADC_STATE_BUSY_INTERNAL;
 	handler->InCalibration = 1;
 	handler->Instance->ADCSRA_REG |= _BV(ADSC); // Start calibration process
@@ -57,11 +469,26 @@ hal_status_t ADC_Init(adc_handler_t *handler){
 hal_status_t ADC_DeInit(adc_handler_t *handler){
 	__HAL_LOCK(handler);
 
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->SeqRunning){
+			handler->SeqRunning = 0;
+			ADC_DropInFlight(handler);
+		}
+	}
 	while(handler->State != ADC_STATE_READY);
 
+	if(handler->SampleRate){
+		Timer_SetClock(TIM1, TIMER_CLOCK_DISABLE);
+		handler->SampleRate = 0;
+	}
 	handler->Instance->ADCSRA_REG = 0;
 	handler->Instance->ADCSRB_REG = 0;
 	handler->Instance->ADMUX_REG = 0;
+	handler->Instance->DIDR0_REG = 0;
+	handler->Instance->DIDR2_REG = 0;
+	for(uint8_t i = 0; i < sizeof(handler->SlotMask); i++){
+		handler->SlotMask[i] = 0;
+	}
 	handler->State = ADC_STATE_RESET;
 	handler->SlotId = 0;
 	
@@ -77,16 +504,180 @@ hal_status_t ADC_ConfigChannelSlot(adc_handler_t *handler, uint8_t SlotId, uint8
 	if(SlotId >= ADC_SLOTS_SIZE){
 		return HAL_ERROR;
 	}
+	uint8_t mux = ADChannel & 0x1F;
+	uint8_t didr0 = 0;
+	uint8_t didr2 = 0;
+
 	handler->ChannelSlot[SlotId].Channel = ADChannel;
+	handler->SlotMask[SlotId >> 3] |= _BV(SlotId & 0x07);
 	handler->ChannelSlot[SlotId].NewResultFlag = 0;
+	// gain stage offset cancellation and bandgap need a first conversion to settle
+	handler->ChannelSlot[SlotId].Settle = (mux >= 0x08 && mux <= ADC_CH_1V1) ? 1 : 0;
+
+	// rebuilt from every configured slot, so the old pins of this slot are released
+	for(uint8_t i = 0; i < ADC_SLOTS_SIZE; i++){
+		if(!(handler->SlotMask[i >> 3] & _BV(i & 0x07)))
+			continue;
+		uint8_t channel = handler->ChannelSlot[i].Channel;
+		if(channel & 0x20)
+			didr2 |= ADC_ChannelPins(channel);
+		else
+			didr0 |= ADC_ChannelPins(channel);
+	}
+	handler->Instance->DIDR0_REG = didr0;
+	handler->Instance->DIDR2_REG = didr2;
+	return HAL_OK;
+}
+
+hal_status_t ADC_SetSlotSettling(adc_handler_t *handler, uint8_t SlotId, uint8_t Count){
+	if(SlotId >= ADC_SLOTS_SIZE){
+		return HAL_ERROR;
+	}
+	handler->ChannelSlot[SlotId].Settle = Count;
+	return HAL_OK;
+}
+
+hal_status_t ADC_SetSlotOversampling(adc_handler_t *handler, uint8_t SlotId, uint8_t Bits){
+	if(SlotId >= ADC_SLOTS_SIZE || Bits > ADC_OVERSAMPLE_MAX){
+		return HAL_ERROR;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		handler->ChannelSlot[SlotId].Oversample = Bits;
+		handler->ChannelSlot[SlotId].Accum = 0;
+		handler->ChannelSlot[SlotId].AccumCount = 0;
+		ADC_UpdateScale(handler, SlotId);
+	}
+	return HAL_OK;
+}
+
+hal_status_t ADC_SetSlotFilter(adc_handler_t *handler, uint8_t SlotId, adc_filter_t Filter, uint8_t Shift, adc_filter_state_t *pState){
+	if(SlotId >= ADC_SLOTS_SIZE || Filter > ADC_FILTER_MEDIAN3){
+		return HAL_ERROR;
+	}
+	if(Filter != ADC_FILTER_NONE && pState == NULL){
+		return HAL_ERROR;
+	}
+	if(Filter == ADC_FILTER_EMA && (Shift == 0 || Shift > ADC_FILTER_EMA_SHIFT_MAX)){
+		return HAL_ERROR;
+	}
+	if(Filter == ADC_FILTER_BOXCAR && (Shift == 0 || Shift > ADC_FILTER_BOXCAR_SHIFT_MAX)){
+		return HAL_ERROR;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(Filter != ADC_FILTER_NONE){
+			pState->Fill = 0;
+			pState->Index = 0;
+		}
+		else {
+			pState = NULL;
+		}
+		handler->ChannelSlot[SlotId].Filter = Filter;
+		handler->ChannelSlot[SlotId].FilterShift = Shift;
+		handler->ChannelSlot[SlotId].FilterState = pState;
+	}
+	return HAL_OK;
+}
+
+hal_status_t ADC_SetSlotWatchdog(adc_handler_t *handler, uint8_t SlotId, uint16_t Low, uint16_t High, uint16_t Hysteresis){
+	if(SlotId >= ADC_SLOTS_SIZE || Low > High){
+		return HAL_ERROR;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		handler->ChannelSlot[SlotId].WdgLow = Low;
+		handler->ChannelSlot[SlotId].WdgHigh = High;
+		handler->ChannelSlot[SlotId].WdgHyst = Hysteresis;
+		handler->ChannelSlot[SlotId].WdgZone = ADC_WDG_INSIDE;
+		handler->ChannelSlot[SlotId].WdgEnable = 1;
+	}
+	return HAL_OK;
+}
+
+hal_status_t ADC_ClearSlotWatchdog(adc_handler_t *handler, uint8_t SlotId){
+	if(SlotId >= ADC_SLOTS_SIZE){
+		return HAL_ERROR;
+	}
+	handler->ChannelSlot[SlotId].WdgEnable = 0;
+	return HAL_OK;
+}
+
+hal_status_t ADC_SetSlotCalibration(adc_handler_t *handler, uint8_t SlotId, uint16_t Gain, int16_t Offset){
+	if(SlotId >= ADC_SLOTS_SIZE){
+		return HAL_ERROR;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		handler->ChannelSlot[SlotId].Gain = Gain;
+		handler->ChannelSlot[SlotId].Offset = Offset;
+		ADC_UpdateScale(handler, SlotId);
+	}
+	return HAL_OK;
+}
+
+hal_status_t ADC_SetVccSlot(adc_handler_t *handler, uint8_t SlotId){
+	if(SlotId != ADC_SLOT_NONE && (SlotId >= ADC_SLOTS_SIZE || handler->ChannelSlot[SlotId].Channel != ADC_CH_1V1)){
+		return HAL_ERROR;
+	}
+	handler->VccSlot = SlotId;
+	handler->VccDirty = 0;
+	return HAL_OK;
+}
+
+void ADC_SetBandgap(adc_handler_t *handler, uint16_t BandgapMv){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		handler->BandgapMv = BandgapMv;
+		ADC_UpdateScaleAll(handler);
+	}
+}
+
+uint16_t ADC_GetVcc(adc_handler_t *handler){
+	uint16_t vcc;
+
+	ADC_UpdateVcc(handler);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		vcc = handler->VccMv;
+	}
+	return vcc;
+}
+
+hal_status_t ADC_LoadCalibration(adc_handler_t *handler, const adc_cal_t *pEeprom){
+	adc_cal_t cal;
+
+	eeprom_read_block(&cal, pEeprom, sizeof(cal));
+	if(cal.Magic != ADC_CAL_MAGIC){
+		return HAL_ERROR;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		handler->BandgapMv = cal.BandgapMv;
+		for(uint8_t i = 0; i < ADC_SLOTS_SIZE; i++){
+			handler->ChannelSlot[i].Gain = cal.Slot[i].Gain;
+			handler->ChannelSlot[i].Offset = cal.Slot[i].Offset;
+			ADC_UpdateScale(handler, i);
+		}
+	}
+	return HAL_OK;
+}
+
+hal_status_t ADC_SaveCalibration(adc_handler_t *handler, adc_cal_t *pEeprom){
+	adc_cal_t cal;
+
+	cal.Magic = ADC_CAL_MAGIC;
+	cal.BandgapMv = handler->BandgapMv;
+	for(uint8_t i = 0; i < ADC_SLOTS_SIZE; i++){
+		cal.Slot[i].Gain = handler->ChannelSlot[i].Gain;
+		cal.Slot[i].Offset = handler->ChannelSlot[i].Offset;
+	}
+	eeprom_update_block(&cal, pEeprom, sizeof(cal));
 	return HAL_OK;
 }
 
 hal_status_t ADC_SelectChannelSlot(adc_handler_t *handler, uint8_t SlotId){
 	/*
-	 *	We are changing the MUX register blindly without knowing if a conversion
-	 *	have already started, thus, we can't ensure if next conversion is based
-	 *	on the old or the new settings if auto trigger in free running is turn on
+	 *	With auto trigger a conversion may have already started with the old
+	 *	MUX settings, ADC_SetDiscard drops it along with settling conversions
 	**/
 	
 	if(SlotId >= ADC_SLOTS_SIZE){
@@ -96,11 +687,12 @@ hal_status_t ADC_SelectChannelSlot(adc_handler_t *handler, uint8_t SlotId){
 		return HAL_BUSY;
 	}
 	__HAL_LOCK(handler);
-	handler->SlotId = SlotId;
-	handler->Instance->ADMUX_REG &= ~(0x1F);
-	handler->Instance->ADCSRB_REG &= ~_BV(MUX5);
-	handler->Instance->ADMUX_REG |= (handler->ChannelSlot[SlotId].Channel & 0x0F);
-	handler->Instance->ADCSRB_REG |= (handler->ChannelSlot[SlotId].Channel & _BV(MUX5) ? _BV(MUX5) : 0x00);	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		handler->SlotId = SlotId;
+		if(ADC_SetMux(handler, handler->ChannelSlot[SlotId].Channel)){
+			ADC_SetDiscard(handler, handler->ChannelSlot[SlotId].Settle);
+		}
+	}
 	__HAL_UNLOCK(handler);
 	return HAL_OK;
 }
@@ -117,6 +709,76 @@ hal_status_t ADC_GetChannelSlotValue(adc_handler_t *handler, uint8_t SlotId, uin
 	return HAL_ERROR;
 }
 
+hal_status_t ADC_GetChannelSlotFiltered(adc_handler_t *handler, uint8_t SlotId, uint16_t *pResult){
+	if(SlotId >= ADC_SLOTS_SIZE){
+		return HAL_ERROR;
+	}
+	if(handler->ChannelSlot[SlotId].NewResultFlag){
+		handler->ChannelSlot[SlotId].NewResultFlag = 0;
+		*pResult = handler->ChannelSlot[SlotId].FiltResult;
+		return HAL_OK;
+	}
+	return HAL_ERROR;
+}
+
+hal_status_t ADC_GetChannelSlotResult(adc_handler_t *handler, uint8_t SlotId, uint16_t *pRaw, uint16_t *pFiltered){
+	volatile adc_slot_t *slot;
+	uint8_t fresh;
+
+	if(SlotId >= ADC_SLOTS_SIZE){
+		return HAL_ERROR;
+	}
+
+	slot = &handler->ChannelSlot[SlotId];
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		// both values of one sample, the IRQ cannot publish in between
+		fresh = slot->NewResultFlag;
+		slot->NewResultFlag = 0;
+		*pRaw = slot->ConvResult;
+		*pFiltered = slot->FiltResult;
+	}
+	return fresh ? HAL_OK : HAL_ERROR;
+}
+
+hal_status_t ADC_SetReference(adc_handler_t *handler, adc_ref_t Reference, uint8_t Discard){
+	__HAL_LOCK(handler);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		handler->Init.Reference = Reference;
+		handler->Instance->ADMUX_REG = (handler->Instance->ADMUX_REG & ~(_BV(REFS1) | _BV(REFS0))) | (Reference << REFS0);
+		ADC_SetDiscard(handler, Discard);
+		ADC_UpdateScaleAll(handler);
+	}
+	__HAL_UNLOCK(handler);
+	return HAL_OK;
+}
+
+hal_status_t ADC_GetChannelSlotMilliVolt(adc_handler_t *handler, uint8_t SlotId, uint16_t *pResult){
+	volatile adc_slot_t *slot;
+	uint16_t result;
+	uint8_t fresh;
+	int32_t x;
+
+	if(SlotId >= ADC_SLOTS_SIZE || handler->ChannelSlot[SlotId].Gain == 0){
+		return HAL_ERROR;
+	}
+
+	slot = &handler->ChannelSlot[SlotId];
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		fresh = slot->NewResultFlag;
+		slot->NewResultFlag = 0;
+		result = slot->FiltResult;
+	}
+	if(!fresh){
+		return HAL_ERROR;
+	}
+
+	// scale of AVCC slots follows the last VCC measurement
+	ADC_UpdateVcc(handler);
+	x = (int32_t)result + slot->Offset;
+	*pResult = (x > 0) ? (uint16_t)(((uint32_t)x * slot->Scale) >> 16) : 0;
+	return HAL_OK;
+}
+
 void ADC_SetCalibration(adc_handler_t *handler){
 	handler->InCalibration = 1;
 }
@@ -151,6 +813,352 @@ hal_status_t ADC_StartConv(adc_handler_t *handler){
 	return HAL_OK;
 }
 
+hal_status_t ADC_ConvertInSleep(adc_handler_t *handler, uint8_t SlotId, uint16_t *pResult){
+	volatile adc_slot_t *slot;
+	uint8_t sreg;
+	uint8_t sm;
+
+	if(SlotId >= ADC_SLOTS_SIZE || pResult == NULL){
+		return HAL_ERROR;
+	}
+	if(handler->Init.AutoTrigState == ADC_AUTO_TRIG_ON){
+		return HAL_ERROR;
+	}
+	if(handler->State != ADC_STATE_READY || handler->SeqRunning){
+		return HAL_BUSY;
+	}
+
+	__HAL_LOCK(handler);
+	slot = &handler->ChannelSlot[SlotId];
+	handler->SlotId = SlotId;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(ADC_SetMux(handler, slot->Channel)){
+			ADC_SetDiscard(handler, slot->Settle);
+		}
+	}
+	slot->NewResultFlag = 0;
+	handler->SleepConv = 1;
+
+	// sleep mode of the application, restored below
+	sm = SMCR & (_BV(SM2) | _BV(SM1) | _BV(SM0));
+	set_sleep_mode(SLEEP_MODE_ADC);
+	sreg = SREG;
+	while(!slot->NewResultFlag){
+		/*
+		 *	Entering ADC noise reduction mode starts a conversion if none is
+		 *	ongoing. Interrupts are enabled right before SLEEP (sei delays one
+		 *	instruction) so the ADC IRQ can't be missed in between.
+		**/
+		cli();
+		if(!slot->NewResultFlag){
+			handler->State = ADC_STATE_BUSY;
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+		}
+		sei();
+	}
+	SREG = sreg;
+	SMCR = (SMCR & ~(_BV(SM2) | _BV(SM1) | _BV(SM0))) | sm;
+	handler->SleepConv = 0;
+
+	*pResult = slot->ConvResult;
+	slot->NewResultFlag = 0;
+	__HAL_UNLOCK(handler);
+	return HAL_OK;
+}
+
+hal_status_t ADC_StartFast8(adc_handler_t *handler, uint8_t *pBuffer, uint16_t Length, adc_presc_t Prescaler){
+	if(pBuffer == NULL || Length == 0){
+		return HAL_ERROR;
+	}
+	if(handler->State != ADC_STATE_READY || handler->SeqRunning){
+		return HAL_BUSY;
+	}
+
+	__HAL_LOCK(handler);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		handler->State = ADC_STATE_BUSY;
+		handler->FastIndex = 0;
+		handler->FastLength = Length;
+		handler->FastBuf = pBuffer;
+
+		handler->Instance->ADMUX_REG |= _BV(ADLAR);
+		handler->Instance->ADCSRB_REG = (handler->Instance->ADCSRB_REG & ~(0x07)) | ADC_TRIG_FREERUN;
+		handler->Instance->ADCSRA_REG = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADIF) | _BV(ADSC) | Prescaler;
+	}
+	__HAL_UNLOCK(handler);
+	return HAL_OK;
+}
+
+hal_status_t ADC_CaptureFast8(adc_handler_t *handler, uint8_t *pBuffer, uint16_t Length, adc_presc_t Prescaler){
+	volatile uint8_t *adch = &((volatile uint8_t *)&handler->Instance->ADC_REG)[1];
+	uint8_t ctrl = _BV(ADEN) | _BV(ADATE) | Prescaler;
+
+	if(pBuffer == NULL || Length == 0){
+		return HAL_ERROR;
+	}
+	if(handler->State != ADC_STATE_READY || handler->SeqRunning){
+		return HAL_BUSY;
+	}
+
+	__HAL_LOCK(handler);
+	handler->State = ADC_STATE_BUSY;
+	handler->Instance->ADMUX_REG |= _BV(ADLAR);
+	handler->Instance->ADCSRB_REG = (handler->Instance->ADCSRB_REG & ~(0x07)) | ADC_TRIG_FREERUN;
+	handler->Instance->ADCSRA_REG = ctrl | _BV(ADIF) | _BV(ADSC);
+
+	for(uint16_t i = 0; i < Length; i++){
+		while(!(handler->Instance->ADCSRA_REG & _BV(ADIF)));
+		pBuffer[i] = *adch;
+		handler->Instance->ADCSRA_REG = ctrl | _BV(ADIF);
+	}
+
+	// stop free running and drop the conversion in flight
+	handler->Instance->ADCSRA_REG = _BV(ADEN) | Prescaler;
+	while(handler->Instance->ADCSRA_REG & _BV(ADSC));
+	handler->Instance->ADCSRA_REG = _BV(ADEN) | _BV(ADIF) | Prescaler;
+
+	ADC_RestoreConfig(handler);
+	handler->State = ADC_STATE_READY;
+	__HAL_UNLOCK(handler);
+	return HAL_OK;
+}
+
+void ADC_RegisterCaptureCallback(adc_handler_t *handler, CaptureCallback_t pCallback){
+	handler->CaptureCpltCallback = pCallback;
+}
+
+void ADC_UnRegisterCaptureCallback(adc_handler_t *handler){
+	handler->CaptureCpltCallback = NULL;
+}
+
+hal_status_t ADC_StartTimed(adc_handler_t *handler, uint32_t SampleRate){
+	static const uint8_t presc_shift[] = {0, 3, 6, 8, 10};
+	timer_init_t tim_init;
+	uint32_t top = 0;
+	uint8_t i;
+
+	if(SampleRate == 0){
+		return HAL_ERROR;
+	}
+	if(handler->SampleRate == 0 && Timer_IsEnabled(TIM1)){
+		return HAL_BUSY; // Timer1 is in use elsewhere
+	}
+
+	// smallest prescaler that fits TOP in 16 bits gives the finest rate step
+	for(i = 0; i < sizeof(presc_shift); i++){
+		uint32_t tim_clk = F_CPU >> presc_shift[i];
+		top = (tim_clk + (SampleRate / 2)) / SampleRate;
+		if(top <= 65536UL){
+			break;
+		}
+	}
+	if(i == sizeof(presc_shift) || top == 0){
+		return HAL_ERROR;
+	}
+
+	uint32_t rate = (F_CPU >> presc_shift[i]) / top;
+	if(rate * ADC_TRIG_CONV_CYCLES > (F_CPU >> handler->Init.ClockPrescaler)){
+		return HAL_ERROR; // trigger would come while converting, and be lost
+	}
+
+	if(handler->SampleRate == 0){
+		handler->TimedTrigMode = handler->Init.AutoTrigMode;
+		handler->TimedTrigState = handler->Init.AutoTrigState;
+	}
+
+	Timer_StructInit(&tim_init);
+	tim_init.Mode = TIMER16_MODE_CTC_OCRA;
+	tim_init.CompA = (uint16_t)(top - 1);
+	tim_init.CompB = (uint16_t)(top - 1); // one match per period
+	Timer_Init(TIM1, &tim_init);
+
+	if(ADC_EnableAutoTrigger(handler, ADC_TRIG_TIM1_COMP_B) != HAL_OK){
+		return HAL_BUSY;
+	}
+	handler->SampleRate = rate;
+	Timer_SetClock(TIM1, (timer_clock_t)(TIMER_CLOCK_PRESC_1 + i));
+	return HAL_OK;
+}
+
+hal_status_t ADC_StopTimed(adc_handler_t *handler){
+	hal_status_t status;
+
+	if(handler->SampleRate == 0){
+		return HAL_OK;
+	}
+
+	Timer_SetClock(TIM1, TIMER_CLOCK_DISABLE);
+	if(handler->TimedTrigState == ADC_AUTO_TRIG_ON){
+		status = ADC_EnableAutoTrigger(handler, handler->TimedTrigMode);
+	}
+	else {
+		status = ADC_DisableAutoTrigger(handler);
+		handler->Init.AutoTrigMode = handler->TimedTrigMode;
+	}
+	if(status != HAL_OK){
+		return HAL_BUSY;
+	}
+	handler->SampleRate = 0;
+	return HAL_OK;
+}
+
+uint32_t ADC_GetSampleRate(adc_handler_t *handler){
+	return handler->SampleRate;
+}
+
+hal_status_t ADC_ConfigSequence(adc_handler_t *handler, const uint8_t *pSlots, uint8_t Length){
+	if(pSlots == NULL || Length == 0 || Length > ADC_SLOTS_SIZE){
+		return HAL_ERROR;
+	}
+	for(uint8_t i = 0; i < Length; i++){
+		if(pSlots[i] >= ADC_SLOTS_SIZE){
+			return HAL_ERROR;
+		}
+	}
+	if(handler->SeqRunning){
+		return HAL_BUSY;
+	}
+
+	__HAL_LOCK(handler);
+	for(uint8_t i = 0; i < Length; i++){
+		handler->Sequence[i] = pSlots[i];
+	}
+	handler->SeqLength = Length;
+	__HAL_UNLOCK(handler);
+	return HAL_OK;
+}
+
+hal_status_t ADC_StartSequence(adc_handler_t *handler){
+	if(handler->SeqLength == 0){
+		return HAL_ERROR;
+	}
+	if(handler->State != ADC_STATE_READY){
+		return HAL_BUSY;
+	}
+
+	__HAL_LOCK(handler);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		uint8_t running = handler->Instance->ADCSRA_REG & _BV(ADSC);
+		uint8_t first = 0;
+		volatile adc_slot_t *slot;
+
+		handler->State = ADC_STATE_BUSY;
+		handler->SlotId = handler->Sequence[0];
+		slot = &handler->ChannelSlot[handler->SlotId];
+		handler->SeqPos = (handler->SeqLength > 1) ? 1 : 0;
+		handler->SeqSettle = 0;
+		for(uint8_t i = 0; i < sizeof(handler->SeqFresh); i++){
+			handler->SeqFresh[i] = 0;
+		}
+		handler->SeqFreshCount = 0;
+		if(ADC_SetMux(handler, slot->Channel) && slot->Settle){
+			// first conversion with the new MUX is a settling one, slot 0 is repeated
+			first = ADC_SEQ_NONE;
+			handler->SeqSettle = slot->Settle - 1;
+			handler->SeqPos = 0;
+		}
+
+		if(ADC_IsFreeRunning(handler)){
+			if(running){
+				// conversion in progress was latched with the old MUX
+				handler->SeqCur = ADC_SEQ_NONE;
+				handler->SeqNext = first;
+				if(handler->Instance->ADCSRA_REG & _BV(ADIF)){
+					// a new conversion started meanwhile, MUX it used is unknown
+					handler->SeqNext = ADC_SEQ_NONE;
+					handler->SeqPos = 0;
+					if(first == ADC_SEQ_NONE)
+						handler->SeqSettle++;
+				}
+			}
+			else {
+				// second conversion starts before the first IRQ, with the same MUX
+				handler->SeqCur = first;
+				handler->SeqNext = ADC_SEQ_NONE;
+				handler->Instance->ADCSRA_REG |= _BV(ADSC);
+			}
+		}
+		else {
+			if(running){
+				handler->SeqCur = ADC_SEQ_NONE;
+				handler->SeqPos = 0;
+				if(first == ADC_SEQ_NONE)
+					handler->SeqSettle++;
+			}
+			else {
+				handler->SeqCur = first;
+				if(handler->Init.AutoTrigState == ADC_AUTO_TRIG_OFF){
+					handler->Instance->ADCSRA_REG |= _BV(ADSC);
+				}
+			}
+		}
+
+		handler->SeqRunning = 1;
+	}
+	__HAL_UNLOCK(handler);
+	return HAL_OK;
+}
+
+hal_status_t ADC_StopSequence(adc_handler_t *handler){
+	__HAL_LOCK(handler);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->SeqRunning){
+			handler->SeqRunning = 0;
+			ADC_DropInFlight(handler);
+		}
+	}
+	__HAL_UNLOCK(handler);
+	return HAL_OK;
+}
+
+hal_status_t ADC_StartStream(adc_handler_t *handler, uint16_t *pBuffer, uint16_t Length){
+	if(pBuffer == NULL || Length < 2 || (Length & 0x01)){
+		return HAL_ERROR;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		handler->StreamIndex = 0;
+		handler->StreamLength = Length;
+		handler->StreamBuf = pBuffer;
+	}
+	return HAL_OK;
+}
+
+hal_status_t ADC_StopStream(adc_handler_t *handler){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		handler->StreamBuf = NULL;
+	}
+	return HAL_OK;
+}
+
+void ADC_RegisterStreamCallback(adc_handler_t *handler, StreamCallback_t pHalfCallback, StreamCallback_t pFullCallback){
+	handler->StreamHalfCallback = pHalfCallback;
+	handler->StreamFullCallback = pFullCallback;
+}
+
+void ADC_UnRegisterStreamCallback(adc_handler_t *handler){
+	handler->StreamHalfCallback = NULL;
+	handler->StreamFullCallback = NULL;
+}
+
+void ADC_RegisterWatchdogCallback(adc_handler_t *handler, WdgCallback_t pCallback){
+	handler->WdgCallback = pCallback;
+}
+
+void ADC_UnRegisterWatchdogCallback(adc_handler_t *handler){
+	handler->WdgCallback = NULL;
+}
+
+void ADC_RegisterScanCallback(adc_handler_t *handler, ScanCpltCallback_t pCallback){
+	handler->ScanCpltCallback = pCallback;
+}
+
+void ADC_UnRegisterScanCallback(adc_handler_t *handler){
+	handler->ScanCpltCallback = NULL;
+}
 
 void ADC_RegisterCallback(adc_handler_t *handler, ConvCpltCallback_t pCallback){
 	handler->ConvCpltCallback = pCallback;
@@ -15,6 +15,7 @@ extern "C" {
 #endif
 
 #include "hal_def.h"
+#include "hal_timer.h"
 
 /**
  * @brief Define channel slot size that will be used by ADC handler struct
@@ -24,6 +25,73 @@ extern "C" {
 	#define ADC_SLOTS_SIZE 8
 #endif
 
+/**
+ * @brief Maximum oversampling extra bits, 4^6 samples give a 16-bit result
+ */
+#define ADC_OVERSAMPLE_MAX 6
+
+/**
+ * @brief Maximum EMA filter shift, alpha = 1/2^Shift
+ */
+#define ADC_FILTER_EMA_SHIFT_MAX 8
+
+/**
+ * @brief Maximum boxcar filter shift, window = 2^Shift samples
+ * @note Every adc_filter_state_t holds 2^ADC_FILTER_BOXCAR_SHIFT_MAX samples of history
+ */
+#ifndef ADC_FILTER_BOXCAR_SHIFT_MAX
+	#define ADC_FILTER_BOXCAR_SHIFT_MAX 3
+#endif
+
+#define ADC_FILTER_HIST_SIZE (1 << ADC_FILTER_BOXCAR_SHIFT_MAX)
+
+/**
+ * @brief Sequencer pipeline entry whose result is discarded
+ */
+#define ADC_SEQ_NONE 0xFF
+
+/**
+ * @brief No slot selected, e.g. VCC measurement disabled
+ */
+#define ADC_SLOT_NONE 0xFF
+
+/**
+ * @brief Nominal internal bandgap voltage, 1.0V to 1.2V across parts
+ */
+#ifndef ADC_BANDGAP_MV
+	#define ADC_BANDGAP_MV 1100
+#endif
+
+/**
+ * @brief VCC assumed until first bandgap measurement
+ */
+#ifndef ADC_VCC_DEFAULT_MV
+	#define ADC_VCC_DEFAULT_MV 5000
+#endif
+
+/**
+ * @brief Voltage applied on AREF pin
+ */
+#ifndef ADC_AREF_MV
+	#define ADC_AREF_MV 5000
+#endif
+
+/**
+ * @brief Unity slot gain, Q1.15 fixed point
+ */
+#define ADC_GAIN_ONE 0x8000
+
+/**
+ * @brief Calibration table EEPROM signature
+ */
+#define ADC_CAL_MAGIC 0xADCA
+
+/**
+ * @brief ADC clock cycles between two auto triggered conversions,
+ *        13.5 cycles for the conversion rounded up to the next trigger
+ */
+#define ADC_TRIG_CONV_CYCLES 14
+
 
 /**
  * @brief ADC state machine: ADC states definition
@@ -78,7 +146,7 @@ typedef enum {
 	ADC_CH5,
 	ADC_CH6,
 	ADC_CH7,
-	ADC_CH8 = 0x10,
+	ADC_CH8 = 0x20,
 	ADC_CH9,
 	ADC_CH10,
 	ADC_CH11,
@@ -165,6 +233,44 @@ typedef enum {
 }adc_trigger_t;
 
 
+/**
+ * @brief ADC Slot Filter
+ * @note Integer only, run from ADC_IRQHandler on every published result.
+ *       EMA and BOXCAR shift a 32-bit value by Shift bits (a loop of Shift
+ *       iterations on AVR), MEDIAN3 is three 16-bit compares. Cost depends
+ *       on the compiler and options: measure it on target before budgeting
+ *       a high sample rate, e.g. Timer1 counting CPU clocks (no prescaler)
+ *       read before and after ADC_IRQHandler.
+ */
+typedef enum {
+	ADC_FILTER_NONE,
+	ADC_FILTER_EMA,			/*!< Exponential moving average, y += (x - y) / 2^Shift */
+	ADC_FILTER_BOXCAR,		/*!< Moving average of last 2^Shift samples, running sum */
+	ADC_FILTER_MEDIAN3,		/*!< Median of last 3 samples, spike rejection */
+}adc_filter_t;
+
+
+/**
+ * @brief ADC Slot Filter State, supplied by the user for filtered slots only
+ */
+typedef struct {
+	uint8_t Fill;							/*!< Filter state seeded with first result */
+	uint8_t Index;							/*!< History write index */
+	uint32_t Acc;							/*!< EMA scaled value or boxcar running sum */
+	uint16_t Hist[ADC_FILTER_HIST_SIZE];	/*!< Boxcar window or median history */
+}adc_filter_state_t;
+
+
+/**
+ * @brief ADC Analog Watchdog Zone, also used as window crossing event
+ */
+typedef enum {
+	ADC_WDG_INSIDE,			/*!< Result inside the window, or window entered */
+	ADC_WDG_BELOW,			/*!< Result below low threshold, or window left downwards */
+	ADC_WDG_ABOVE,			/*!< Result above high threshold, or window left upwards */
+}adc_wdg_zone_t;
+
+
 /**
  * @brief ADC Slot Struct definition
  */
@@ -172,8 +278,41 @@ typedef struct {
 	uint8_t Channel;			/*!< ADC channel MUX value */
 	uint16_t ConvResult;		/*!< Last Conversion value */
 	uint8_t NewResultFlag;		/*!< New conversion result flag */
+	uint8_t Oversample;			/*!< Oversampling extra bits n, 4^n samples per result, 0 disabled */
+	uint32_t Accum;				/*!< Oversampling accumulator */
+	uint16_t AccumCount;		/*!< Oversampling accumulated samples */
+	uint16_t FiltResult;		/*!< Last filtered value, ConvResult when filter is disabled */
+	adc_filter_t Filter;		/*!< Result filter */
+	uint8_t FilterShift;		/*!< EMA alpha or boxcar window shift */
+	adc_filter_state_t *FilterState;	/*!< Filter state, NULL when filter is disabled */
+	uint8_t WdgEnable;			/*!< Analog watchdog enabled */
+	adc_wdg_zone_t WdgZone;		/*!< Analog watchdog current zone */
+	uint16_t WdgLow;			/*!< Analog watchdog low threshold */
+	uint16_t WdgHigh;			/*!< Analog watchdog high threshold */
+	uint16_t WdgHyst;			/*!< Analog watchdog hysteresis to enter the window back */
+	uint8_t Settle;				/*!< Conversions discarded after the MUX switches to this channel */
+	uint16_t Gain;				/*!< Calibration gain, Q1.15, 0 disables millivolt conversion */
+	int16_t Offset;				/*!< Calibration offset in result LSB, added before gain */
+	uint32_t Scale;				/*!< Gain and reference voltage in one factor, Q16 mV/LSB */
 }adc_slot_t;
 
+/**
+ * @brief ADC slot calibration entry
+ */
+typedef struct {
+	uint16_t Gain;				/*!< Q1.15 gain, ADC_GAIN_ONE for 1.0 */
+	int16_t Offset;				/*!< Offset in result LSB */
+}adc_slot_cal_t;
+
+/**
+ * @brief ADC calibration table, as stored in EEPROM
+ */
+typedef struct {
+	uint16_t Magic;							/*!< ADC_CAL_MAGIC when table is valid */
+	uint16_t BandgapMv;						/*!< Measured bandgap voltage */
+	adc_slot_cal_t Slot[ADC_SLOTS_SIZE];	/*!< Per slot gain and offset */
+}adc_cal_t;
+
 /**
  * @brief Structure definition of ADC initialization
  */
@@ -195,8 +334,39 @@ typedef struct _adc_handler {
 	volatile uint8_t InCalibration;											/*!< ADC InCalibration State */
 	volatile adc_state_t State;												/*!< ADC State */
 	volatile adc_slot_t ChannelSlot[ADC_SLOTS_SIZE];						/*!< Slot Channel Array */
+	uint8_t SlotMask[(ADC_SLOTS_SIZE + 7) >> 3];							/*!< Slots set by ADC_ConfigChannelSlot, bit (SlotId & 7) of [SlotId >> 3] */
 	uint8_t SlotId;															/*!< Selected slot channel ID */
+	uint8_t MuxChannel;														/*!< Channel currently set on the MUX */
+	volatile uint8_t Discard;												/*!< Conversions left to discard after a MUX or reference switch */
+	volatile uint8_t SleepConv;												/*!< Conversions driven by ADC_ConvertInSleep */
+	uint8_t VccSlot;														/*!< Slot measuring the 1.1V bandgap, ADC_SLOT_NONE if disabled */
+	uint16_t BandgapMv;														/*!< Bandgap voltage */
+	uint16_t VccMv;															/*!< Last measured VCC */
+	volatile uint8_t VccDirty;												/*!< VCC slot result not converted to VccMv yet */
+	uint8_t Sequence[ADC_SLOTS_SIZE];										/*!< Scan sequencer slot order */
+	uint8_t SeqLength;														/*!< Scan sequence length */
+	volatile uint8_t SeqRunning;											/*!< Scan sequencer running */
+	uint8_t SeqPos;															/*!< Sequence position of the next MUX setting */
+	volatile uint8_t SeqCur;												/*!< Sequence position of the conversion ending at next IRQ */
+	uint8_t SeqNext;														/*!< Free running: sequence position of the conversion after it */
+	uint8_t SeqSettle;														/*!< Settling conversions left before SeqPos is published */
+	uint8_t SeqFresh[(ADC_SLOTS_SIZE + 7) >> 3];							/*!< Sequence positions published since the last ScanCpltCallback */
+	uint8_t SeqFreshCount;													/*!< Bits set in SeqFresh */
+	uint16_t *volatile StreamBuf;											/*!< Streaming ring buffer, NULL when not streaming */
+	uint16_t StreamLength;													/*!< Streaming ring buffer length */
+	volatile uint16_t StreamIndex;											/*!< Streaming ring buffer write index */
+	uint8_t *volatile FastBuf;												/*!< Fast 8-bit capture buffer, NULL when not capturing */
+	uint16_t FastLength;													/*!< Fast 8-bit capture length */
+	volatile uint16_t FastIndex;											/*!< Fast 8-bit capture write index */
+	uint32_t SampleRate;													/*!< Achieved timed sample rate in Hz, 0 when not timed */
+	adc_trigger_t TimedTrigMode;											/*!< Auto trigger mode restored by ADC_StopTimed */
+	adc_auto_trigger_state_t TimedTrigState;								/*!< Auto trigger state restored by ADC_StopTimed */
 	void (*ConvCpltCallback)(struct _adc_handler *handler, uint8_t SlotID);	/*!< ADC conversion complete callback */
+	void (*ScanCpltCallback)(struct _adc_handler *handler);					/*!< ADC scan complete callback */
+	void (*StreamHalfCallback)(struct _adc_handler *handler, uint16_t *pData, uint16_t Length);	/*!< First buffer half filled */
+	void (*StreamFullCallback)(struct _adc_handler *handler, uint16_t *pData, uint16_t Length);	/*!< Second buffer half filled */
+	void (*WdgCallback)(struct _adc_handler *handler, uint8_t SlotID, adc_wdg_zone_t Zone);		/*!< Analog watchdog window crossing */
+	void (*CaptureCpltCallback)(struct _adc_handler *handler, uint8_t *pData, uint16_t Length);	/*!< Fast 8-bit capture done */
 }adc_handler_t;
 
 
@@ -205,6 +375,26 @@ typedef struct _adc_handler {
  */
 typedef void (*ConvCpltCallback_t)(adc_handler_t *handler, uint8_t SlotID);
 
+/**
+ * @brief ADC Scan Complete Callback TypeDef
+ */
+typedef void (*ScanCpltCallback_t)(adc_handler_t *handler);
+
+/**
+ * @brief ADC Stream Callback TypeDef, receives the buffer half ready to be consumed
+ */
+typedef void (*StreamCallback_t)(adc_handler_t *handler, uint16_t *pData, uint16_t Length);
+
+/**
+ * @brief ADC Analog Watchdog Callback TypeDef, receives the zone just entered
+ */
+typedef void (*WdgCallback_t)(adc_handler_t *handler, uint8_t SlotID, adc_wdg_zone_t Zone);
+
+/**
+ * @brief ADC Fast Capture Complete Callback TypeDef
+ */
+typedef void (*CaptureCallback_t)(adc_handler_t *handler, uint8_t *pData, uint16_t Length);
+
 
 /**
  * @brief ADC IRQ Handler function
@@ -247,7 +437,13 @@ adc_state_t ADC_GetState(adc_handler_t *handler);
 
 /**
  * @brief Setup internal slot array item with a specific ADC channel
+ * @note Digital input buffers of the pins used by the configured slots are
+ *       disabled (DIDR0/DIDR2), pins left unused by a reconfigured slot get
+ *       their digital input back.
+ *       Differential and 1.1V bandgap channels discard one settling conversion
+ *       by default.
  * 
+ * @see ADC_SetSlotSettling
  * @see ADC_SLOTS_SIZE
  * @see adc_single_ended_channel_t
  * @see adc_diff_channel_t
@@ -259,6 +455,152 @@ adc_state_t ADC_GetState(adc_handler_t *handler);
  */
 hal_status_t ADC_ConfigChannelSlot(adc_handler_t *handler, uint8_t SlotId, uint8_t ADChannel);
 
+/**
+ * @brief Setup slot settling conversions
+ * @note Whenever the MUX switches to the slot channel, the first Count
+ *       conversions are discarded: in single conversion mode they are
+ *       restarted from the IRQ, the scan sequencer repeats the slot before
+ *       moving on. A conversion latched with the previous channel is always
+ *       discarded, whatever Count is.
+ * 
+ * @param handler ADC Handler Pointer
+ * @param SlotId Slot ID, should be smaller than ADC_SLOTS_SIZE
+ * @param Count Conversions discarded after a MUX switch
+ * @return HAL Status
+ */
+hal_status_t ADC_SetSlotSettling(adc_handler_t *handler, uint8_t SlotId, uint8_t Count);
+
+/**
+ * @brief Setup slot oversampling and decimation
+ * @note ConvResult is published once every 4^Bits conversions of the slot,
+ *       as their sum shifted right by Bits: a (10 + Bits)-bit value for
+ *       right aligned data. Noise must be at least 1 LSB for the extra bits
+ *       to be meaningful.
+ * 
+ * @see ADC_OVERSAMPLE_MAX
+ * 
+ * @param handler ADC Handler Pointer
+ * @param SlotId Slot ID, should be smaller than ADC_SLOTS_SIZE
+ * @param Bits Extra resolution bits n, 0 disables oversampling
+ * @return HAL Status
+ */
+hal_status_t ADC_SetSlotOversampling(adc_handler_t *handler, uint8_t SlotId, uint8_t Bits);
+
+/**
+ * @brief Setup slot result filter
+ * @note Filter runs on ConvResult (after oversampling) and its output is
+ *       stored on FiltResult, the raw ConvResult is kept. Filter state is
+ *       seeded with the first result after this call. pState is owned by
+ *       the slot until the filter is changed, so slots without a filter
+ *       cost no history RAM.
+ * 
+ * @see adc_filter_t
+ * @see ADC_GetChannelSlotFiltered
+ * 
+ * @param handler ADC Handler Pointer
+ * @param SlotId Slot ID, should be smaller than ADC_SLOTS_SIZE
+ * @param Filter Filter type, ADC_FILTER_NONE disables it
+ * @param Shift EMA: alpha = 1/2^Shift, 1 to ADC_FILTER_EMA_SHIFT_MAX.
+ *              BOXCAR: 2^Shift samples, 1 to ADC_FILTER_BOXCAR_SHIFT_MAX.
+ *              Ignored otherwise.
+ * @param pState Filter state, may be NULL with ADC_FILTER_NONE
+ * @return HAL Status
+ */
+hal_status_t ADC_SetSlotFilter(adc_handler_t *handler, uint8_t SlotId, adc_filter_t Filter, uint8_t Shift, adc_filter_state_t *pState);
+
+/**
+ * @brief Setup slot analog watchdog
+ * @note Evaluated from ADC_IRQHandler on FiltResult. The window is left
+ *       when the result goes below Low or above High, and entered back only
+ *       once it is Hysteresis inside the thresholds. WdgCallback is called
+ *       on window entry or exit only. The window is assumed entered when
+ *       set, a first result out of it calls WdgCallback.
+ * 
+ * @see ADC_RegisterWatchdogCallback
+ * 
+ * @param handler ADC Handler Pointer
+ * @param SlotId Slot ID, should be smaller than ADC_SLOTS_SIZE
+ * @param Low Low threshold
+ * @param High High threshold, not smaller than Low
+ * @param Hysteresis Margin to enter the window back
+ * @return HAL Status
+ */
+hal_status_t ADC_SetSlotWatchdog(adc_handler_t *handler, uint8_t SlotId, uint16_t Low, uint16_t High, uint16_t Hysteresis);
+
+/**
+ * @brief Disable slot analog watchdog
+ * 
+ * @param handler ADC Handler Pointer
+ * @param SlotId Slot ID, should be smaller than ADC_SLOTS_SIZE
+ * @return HAL Status
+ */
+hal_status_t ADC_ClearSlotWatchdog(adc_handler_t *handler, uint8_t SlotId);
+
+/**
+ * @brief Setup slot calibration
+ * @note ADC_GetChannelSlotMilliVolt converts the last result, nothing runs
+ *       from the IRQ: mV = (FiltResult + Offset) * Gain / 2^15 * Vref / 2^bits,
+ *       with Vref the measured VCC for AVCC reference. It costs a 32x32-bit
+ *       multiply on the caller side. Results must be right aligned.
+ * 
+ * @see ADC_GetChannelSlotMilliVolt
+ * 
+ * @param handler ADC Handler Pointer
+ * @param SlotId Slot ID, should be smaller than ADC_SLOTS_SIZE
+ * @param Gain Q1.15 gain, ADC_GAIN_ONE for 1.0, 0 disables calibration
+ * @param Offset Offset in result LSB, added before gain
+ * @return HAL Status
+ */
+hal_status_t ADC_SetSlotCalibration(adc_handler_t *handler, uint8_t SlotId, uint16_t Gain, int16_t Offset);
+
+/**
+ * @brief Setup slot used to measure VCC
+ * @note Slot channel must be ADC_CH_1V1 and reference AVCC. The IRQ only
+ *       flags each result of the slot (e.g. as part of a scan sequence), VCC
+ *       is computed as BandgapMv * 2^bits / result and calibrated slots are
+ *       rescaled by the next ADC_GetVcc or ADC_GetChannelSlotMilliVolt call.
+ * 
+ * @param handler ADC Handler Pointer
+ * @param SlotId Slot ID, ADC_SLOT_NONE disables VCC measurement
+ * @return HAL Status
+ */
+hal_status_t ADC_SetVccSlot(adc_handler_t *handler, uint8_t SlotId);
+
+/**
+ * @brief Set bandgap voltage, e.g. computed from a VCC measured with a meter
+ * 
+ * @param handler ADC Handler Pointer
+ * @param BandgapMv Bandgap voltage in mV
+ */
+void ADC_SetBandgap(adc_handler_t *handler, uint16_t BandgapMv);
+
+/**
+ * @brief Return last measured VCC
+ * 
+ * @param handler ADC Handler Pointer
+ * @return VCC in mV, ADC_VCC_DEFAULT_MV until measured
+ */
+uint16_t ADC_GetVcc(adc_handler_t *handler);
+
+/**
+ * @brief Load bandgap and slot calibration from EEPROM
+ * 
+ * @param handler ADC Handler Pointer
+ * @param pEeprom Calibration table address in EEPROM (EEMEM)
+ * @return HAL Status: HAL_ERROR if table is not valid
+ */
+hal_status_t ADC_LoadCalibration(adc_handler_t *handler, const adc_cal_t *pEeprom);
+
+/**
+ * @brief Store bandgap and slot calibration to EEPROM, unchanged bytes are not rewritten
+ * @note This function blocks while EEPROM is written
+ * 
+ * @param handler ADC Handler Pointer
+ * @param pEeprom Calibration table address in EEPROM (EEMEM)
+ * @return HAL Status
+ */
+hal_status_t ADC_SaveCalibration(adc_handler_t *handler, adc_cal_t *pEeprom);
+
 /**
  * @brief Configure ADC MUX with selected slot id and prepare for next conversion
  * 
@@ -283,6 +625,63 @@ hal_status_t ADC_SelectChannelSlot(adc_handler_t *handler, uint8_t SlotId);
  */
 hal_status_t ADC_GetChannelSlotValue(adc_handler_t *handler, uint8_t SlotId, uint16_t *pResult);
 
+/**
+ * @brief Return last filtered result from slot id
+ * @note Shares the new result flag with ADC_GetChannelSlotValue, use
+ *       ADC_GetChannelSlotResult to get both values of the same sample
+ * 
+ * @see ADC_SetSlotFilter
+ * 
+ * @param handler ADC Handler Pointer
+ * @param SlotId Slot ID, should be smaller than ADC_SLOTS_SIZE
+ * @param[out] pResult Pointer for uint16_t variable
+ * @return HAL Status: HAL_OK if result is available, otherwise HAL_ERROR
+ */
+hal_status_t ADC_GetChannelSlotFiltered(adc_handler_t *handler, uint8_t SlotId, uint16_t *pResult);
+
+/**
+ * @brief Return last raw and filtered results from slot id, both from the
+ *        same sample, and clear the new result flag once
+ * 
+ * @see ADC_SetSlotFilter
+ * 
+ * @param handler ADC Handler Pointer
+ * @param SlotId Slot ID, should be smaller than ADC_SLOTS_SIZE
+ * @param[out] pRaw Pointer for uint16_t variable, ConvResult
+ * @param[out] pFiltered Pointer for uint16_t variable, FiltResult
+ * @return HAL Status: HAL_OK if result is available, otherwise HAL_ERROR
+ */
+hal_status_t ADC_GetChannelSlotResult(adc_handler_t *handler, uint8_t SlotId, uint16_t *pRaw, uint16_t *pFiltered);
+
+/**
+ * @brief Return last calibrated result from slot id in millivolts
+ * @note Shares the new result flag with ADC_GetChannelSlotValue
+ * 
+ * @see ADC_SetSlotCalibration
+ * 
+ * @param handler ADC Handler Pointer
+ * @param SlotId Slot ID, should be smaller than ADC_SLOTS_SIZE
+ * @param[out] pResult Pointer for uint16_t variable
+ * @return HAL Status: HAL_OK if result is available, otherwise HAL_ERROR
+ */
+hal_status_t ADC_GetChannelSlotMilliVolt(adc_handler_t *handler, uint8_t SlotId, uint16_t *pResult);
+
+
+/**
+ * @brief Switch ADC voltage reference
+ * @note Conversions in flight with the previous reference are discarded
+ *       as well. Internal references need their AREF capacitor to settle,
+ *       mostly when switching down from AVCC.
+ * 
+ * @see adc_ref_t
+ * 
+ * @param handler ADC Handler Pointer
+ * @param Reference New voltage reference
+ * @param Discard Conversions discarded after the switch
+ * @return HAL Status
+ */
+hal_status_t ADC_SetReference(adc_handler_t *handler, adc_ref_t Reference, uint8_t Discard);
+
 
 /**
  * @brief Discard next conversion, used for peripheral initialization
@@ -326,6 +725,245 @@ hal_status_t ADC_DisableAutoTrigger(adc_handler_t *handler);
 hal_status_t ADC_StartConv(adc_handler_t *handler);
 
 
+/**
+ * @brief Convert slot channel in ADC Noise Reduction sleep mode
+ * @note CPU and I/O clocks are halted during the conversion, the ADC IRQ
+ *       wakes the core. Other enabled interrupts waking it earlier let the
+ *       conversion finish in active mode, losing the noise benefit: keep
+ *       them quiet meanwhile. Timers clocked from the I/O clock (Tick) stop
+ *       while sleeping. Global interrupts are enabled during the call and
+ *       restored after. Oversampled slots convert until a result is published.
+ *       Auto trigger must be disabled.
+ * 
+ * @param handler ADC Handler Pointer
+ * @param SlotId Slot ID, should be smaller than ADC_SLOTS_SIZE
+ * @param[out] pResult Pointer for uint16_t variable
+ * @return HAL Status
+ */
+hal_status_t ADC_ConvertInSleep(adc_handler_t *handler, uint8_t SlotId, uint16_t *pResult);
+
+
+/**
+ * @brief Start timed conversions, triggered by Timer1 compare B
+ * @note Timer1 is set in CTC mode with OCR1A as TOP and OCR1B at TOP, the
+ *       prescaler and TOP are picked for the closest rate to SampleRate.
+ *       Timer1 is reserved for the ADC until ADC_StopTimed and must not be
+ *       used or reconfigured meanwhile. The auto trigger setup is saved and
+ *       restored by ADC_StopTimed. Calling it again while timed only changes
+ *       the rate. Conversions start
+ *       from the timer hardware, ADC_IRQHandler clears OCF1B so that every
+ *       compare match triggers one. Works with the selected slot or the
+ *       scan sequencer, the sample rate is then shared among its slots.
+ * 
+ * @see ADC_GetSampleRate
+ * 
+ * @param handler ADC Handler Pointer
+ * @param SampleRate Conversions per second
+ * @return HAL Status: HAL_ERROR if the rate is out of the timer range or faster
+ *         than a conversion with the configured ADC clock prescaller, HAL_BUSY
+ *         if Timer1 is already running for something else
+ */
+hal_status_t ADC_StartTimed(adc_handler_t *handler, uint32_t SampleRate);
+
+
+/**
+ * @brief Stop timed conversions, Timer1 clock is disabled and the auto trigger
+ *        setup found by ADC_StartTimed restored
+ * 
+ * @param handler ADC Handler Pointer
+ * @return HAL Status
+ */
+hal_status_t ADC_StopTimed(adc_handler_t *handler);
+
+
+/**
+ * @brief Return the achieved timed sample rate
+ * 
+ * @param handler ADC Handler Pointer
+ * @return Sample rate in Hz, 0 if timed conversions are stopped
+ */
+uint32_t ADC_GetSampleRate(adc_handler_t *handler);
+
+
+/**
+ * @brief Setup scan sequencer slot order
+ * 
+ * @see ADC_ConfigChannelSlot
+ * 
+ * @param handler ADC Handler Pointer
+ * @param pSlots Slot IDs in conversion order
+ * @param Length Number of slots, up to ADC_SLOTS_SIZE
+ * @return HAL Status
+ */
+hal_status_t ADC_ConfigSequence(adc_handler_t *handler, const uint8_t *pSlots, uint8_t Length);
+
+
+/**
+ * @brief Start scan sequencer
+ * @note ADC_IRQHandler switches the MUX to the next slot of the sequence by
+ *       itself and stores each result on its slot. Without auto trigger the
+ *       next conversion is started from the IRQ, with a timer trigger on each
+ *       event and in free running mode back to back. ConvCpltCallback is
+ *       called for every result and ScanCpltCallback at the end of a scan
+ *       once every position of the sequence has a fresh result: with
+ *       oversampling slots, every 4^n scans. The scan repeats until stopped.
+ * 
+ * @see ADC_ConfigSequence
+ * 
+ * @param handler ADC Handler Pointer
+ * @return HAL Status
+ */
+hal_status_t ADC_StartSequence(adc_handler_t *handler);
+
+
+/**
+ * @brief Stop scan sequencer
+ * @note In free running mode conversions go on, results are stored on last selected slot id
+ * 
+ * @param handler ADC Handler Pointer
+ * @return HAL Status
+ */
+hal_status_t ADC_StopSequence(adc_handler_t *handler);
+
+
+/**
+ * @brief Start streaming conversions into a ring buffer
+ * @note Every raw conversion (before oversampling) is appended to pBuffer:
+ *       samples of the selected slot, or the interleaved scan when the
+ *       sequencer runs. StreamHalfCallback is called when the first half is
+ *       filled and StreamFullCallback when the second half is, then writing
+ *       wraps around. Each half must be consumed while the other one fills.
+ * 
+ * @param handler ADC Handler Pointer
+ * @param pBuffer Ring buffer
+ * @param Length Ring buffer length in samples, must be even
+ * @return HAL Status
+ */
+hal_status_t ADC_StartStream(adc_handler_t *handler, uint16_t *pBuffer, uint16_t Length);
+
+
+/**
+ * @brief Stop streaming conversions
+ * 
+ * @param handler ADC Handler Pointer
+ * @return HAL Status
+ */
+hal_status_t ADC_StopStream(adc_handler_t *handler);
+
+
+/**
+ * @brief Start fast 8-bit capture of the selected slot channel from the IRQ
+ * @note The ADC runs in free running mode with left aligned data, only ADCH
+ *       is read and stored from ADC_IRQHandler, bypassing slot processing.
+ *       At 16MHz, ADC_PRESC_DIV16 (1MHz ADC clock) gives 76.9kSPS and
+ *       ADC_PRESC_DIV8 153kSPS with reduced accuracy, at which point the IRQ
+ *       can't keep up. Init configuration is restored once Length samples
+ *       are stored, then CaptureCpltCallback is called.
+ * 
+ * @see ADC_SelectChannelSlot
+ * 
+ * @param handler ADC Handler Pointer
+ * @param pBuffer Sample buffer
+ * @param Length Number of samples
+ * @param Prescaler ADC clock prescaller used during capture
+ * @return HAL Status
+ */
+hal_status_t ADC_StartFast8(adc_handler_t *handler, uint8_t *pBuffer, uint16_t Length, adc_presc_t Prescaler);
+
+
+/**
+ * @brief Fast 8-bit capture of the selected slot channel, polling the ADC flag
+ * @note Same setup as ADC_StartFast8 with the ADC IRQ disabled, the ADC
+ *       keeps the sample clock. This function blocks until Length samples
+ *       are stored. Interrupts taking longer than one conversion make it
+ *       miss samples, disable them for a gap free capture.
+ * 
+ * @param handler ADC Handler Pointer
+ * @param pBuffer Sample buffer
+ * @param Length Number of samples
+ * @param Prescaler ADC clock prescaller used during capture
+ * @return HAL Status
+ */
+hal_status_t ADC_CaptureFast8(adc_handler_t *handler, uint8_t *pBuffer, uint16_t Length, adc_presc_t Prescaler);
+
+
+/**
+ * @brief Register user fast capture complete callback
+ * 
+ * @see CaptureCallback_t
+ * 
+ * @param handler ADC Handler Pointer
+ * @param pCallback Pointer to the Callback function
+ */
+void ADC_RegisterCaptureCallback(adc_handler_t *handler, CaptureCallback_t pCallback);
+
+
+/**
+ * @brief Unregister fast capture complete callback
+ * 
+ * @param handler ADC Handler Pointer
+ */
+void ADC_UnRegisterCaptureCallback(adc_handler_t *handler);
+
+
+/**
+ * @brief Register user stream callbacks
+ * 
+ * @see StreamCallback_t
+ * 
+ * @param handler ADC Handler Pointer
+ * @param pHalfCallback Called with the first buffer half
+ * @param pFullCallback Called with the second buffer half
+ */
+void ADC_RegisterStreamCallback(adc_handler_t *handler, StreamCallback_t pHalfCallback, StreamCallback_t pFullCallback);
+
+
+/**
+ * @brief Unregister stream callbacks
+ * 
+ * @param handler ADC Handler Pointer
+ */
+void ADC_UnRegisterStreamCallback(adc_handler_t *handler);
+
+
+/**
+ * @brief Register user analog watchdog callback
+ * 
+ * @see WdgCallback_t
+ * 
+ * @param handler ADC Handler Pointer
+ * @param pCallback Pointer to the Callback function
+ */
+void ADC_RegisterWatchdogCallback(adc_handler_t *handler, WdgCallback_t pCallback);
+
+
+/**
+ * @brief Unregister analog watchdog callback
+ * 
+ * @param handler ADC Handler Pointer
+ */
+void ADC_UnRegisterWatchdogCallback(adc_handler_t *handler);
+
+
+/**
+ * @brief Register user scan complete callback
+ * 
+ * @see ScanCpltCallback_t
+ * 
+ * @param handler ADC Handler Pointer
+ * @param pCallback Pointer to the Callback function
+ */
+void ADC_RegisterScanCallback(adc_handler_t *handler, ScanCpltCallback_t pCallback);
+
+
+/**
+ * @brief Unregister scan complete callback
+ * 
+ * @param handler ADC Handler Pointer
+ */
+void ADC_UnRegisterScanCallback(adc_handler_t *handler);
+
+
 /**
  * @brief Register user conversion complete callback
  * 
@@ -6,13 +6,17 @@ extern "C" {
 #endif
 
 // #include <inttypes.h>
-#include <avr/io.h>
 #include <stdint.h>
+#ifndef HAL_HOST
+#include <avr/io.h>
 #include <util/atomic.h>
+#endif
 
 
 #if defined (__AVR_ATmega2560__)
     #include "cores/mega2560.h"
+#elif defined (HAL_HOST)
+    #include "cores/host.h"
 #else
     #error "AVR-HAL Incompatible Device"
 #endif
@@ -0,0 +1,613 @@
+/**
+ * @file hal_sd.c
+ * @author Matheus Alencar Nascimento (matt-alencar)
+ * @brief This file provides firmware functions to manage SD/MMC cards in
+ *        SPI mode on top of SPI HAL driver:
+ *           + Initialization and de-initialization functions
+ *             ++ Card identification and high speed clock switch
+ *           + Operation functions
+ *             ++ CMD25 multiple block write stream with ACMD23 pre-erase
+ *             ++ CMD18 multiple block read stream
+ *             ++ Double buffered block queue
+ *           + State functions
+ *             ++ Deferred busy / token polling
+ *
+ **************************************************************************
+ * @copyright MIT License.
+ *
+ */
+
+#include "hal_sd.h"
+
+
+#define SD_CMD0		0	/* GO_IDLE_STATE */
+#define SD_CMD8		8	/* SEND_IF_COND */
+#define SD_CMD12	12	/* STOP_TRANSMISSION */
+#define SD_CMD16	16	/* SET_BLOCKLEN */
+#define SD_CMD18	18	/* READ_MULTIPLE_BLOCK */
+#define SD_CMD25	25	/* WRITE_MULTIPLE_BLOCK */
+#define SD_CMD55	55	/* APP_CMD */
+#define SD_CMD58	58	/* READ_OCR */
+#define SD_ACMD23	23	/* SET_WR_BLK_ERASE_COUNT */
+#define SD_ACMD41	41	/* SD_SEND_OP_COND */
+
+#define SD_R1_IDLE				0x01
+#define SD_R1_ILLEGAL_CMD		0x04
+
+#define SD_TOKEN_START_BLOCK	0xFE
+#define SD_TOKEN_START_MULTI	0xFC
+#define SD_TOKEN_STOP_TRAN		0xFD
+#define SD_DATA_RESP_MASK		0x1F
+#define SD_DATA_RESP_ACCEPTED	0x05
+
+
+/* PRIVATE FUNCTIONS */
+static void SD_SpiCpltCallback(spi_handler_t *spi);
+static void SD_StartBlock(sd_handler_t *handler);
+static void SD_BlockDone(sd_handler_t *handler);
+static void SD_StreamError(sd_handler_t *handler, sd_error_t err);
+static void SD_Transmit(sd_handler_t *handler, uint8_t *pData, uint8_t Size);
+static void SD_Receive(sd_handler_t *handler, uint8_t *pData, uint8_t Size);
+static void SD_Attach(sd_handler_t *handler);
+static void SD_Detach(sd_handler_t *handler);
+/* END OF PRIVATE FUNCTIONS */
+
+
+static inline void SD_Select(sd_handler_t *handler){
+	GPIO_ResetPin(handler->Init.CSGpio, handler->Init.CSPin);
+}
+
+static inline void SD_Deselect(sd_handler_t *handler){
+	GPIO_SetPin(handler->Init.CSGpio, handler->Init.CSPin);
+}
+
+/* Takes the SPI handler from Init / stream start to the end of the
+ * operation: completion callbacks and DI high (0xFF dummy byte) while
+ * the card answers, whatever the other devices on the bus use */
+static void SD_Attach(sd_handler_t *handler){
+	spi_handler_t *spi = handler->Spi;
+
+	if(spi->Owner == handler){
+		return;
+	}
+
+	handler->SpiOwner = spi->Owner;
+	handler->SpiTxCpltCallback = spi->TxCpltCallback;
+	handler->SpiRxCpltCallback = spi->RxCpltCallback;
+	handler->SpiTxRxCpltCallback = spi->TxRxCpltCallback;
+	handler->SpiDummyByte = spi->DummyByte;
+	spi->Owner = handler;
+	spi->TxCpltCallback = SD_SpiCpltCallback;
+	spi->RxCpltCallback = SD_SpiCpltCallback;
+	spi->TxRxCpltCallback = NULL;	// Command phases are blocking
+	spi->DummyByte = 0xFF;
+}
+
+static void SD_Detach(sd_handler_t *handler){
+	spi_handler_t *spi = handler->Spi;
+
+	if(spi->Owner != handler){
+		return;
+	}
+
+	spi->Owner = handler->SpiOwner;
+	spi->TxCpltCallback = handler->SpiTxCpltCallback;
+	spi->RxCpltCallback = handler->SpiRxCpltCallback;
+	spi->TxRxCpltCallback = handler->SpiTxRxCpltCallback;
+	spi->DummyByte = handler->SpiDummyByte;
+}
+
+/* Keeps a bus failure, it is the cause of whatever failed after it */
+static inline void SD_SetError(sd_handler_t *handler, sd_error_t err){
+	if(handler->ErrCode != SD_ERR_BUS)
+		handler->ErrCode = err;
+}
+
+/* Blocking byte exchange, only used on command phases. A refused byte
+ * sets SD_ERR_BUS, its 0xFF must not be taken as a card answer */
+static uint8_t SD_SpiByte(sd_handler_t *handler, uint8_t data){
+	uint8_t recv = 0xFF;
+	if(SPI_TransmitReceive(handler->Spi, &data, &recv, 1) == HAL_OK){
+		while(SPI_GetState(handler->Spi) != SPI_STATE_READY);
+	}
+	else {
+		handler->ErrCode = SD_ERR_BUS;
+	}
+	return recv;
+}
+
+static uint8_t SD_WaitReady(sd_handler_t *handler){
+	uint16_t timeout = 0xFFFF;
+	while(SD_SpiByte(handler, 0xFF) != 0xFF){
+		if(--timeout == 0)
+			return 0;
+	}
+	return (handler->ErrCode != SD_ERR_BUS);
+}
+
+static uint8_t SD_Command(sd_handler_t *handler, uint8_t cmd, uint32_t arg){
+	uint8_t crc = 0xFF;	// CRC is ignored in SPI mode except on CMD0 and CMD8
+	uint8_t r1;
+	uint8_t retry = 10;
+
+	if(cmd == SD_CMD0)
+		crc = 0x95;
+	else if(cmd == SD_CMD8)
+		crc = 0x87;
+
+	if(cmd != SD_CMD0 && cmd != SD_CMD12){
+		if(!SD_WaitReady(handler) && handler->ErrCode == SD_ERR_BUS)
+			return 0xFF;
+	}
+
+	SD_SpiByte(handler, 0x40 | cmd);
+	SD_SpiByte(handler, (uint8_t)(arg >> 24));
+	SD_SpiByte(handler, (uint8_t)(arg >> 16));
+	SD_SpiByte(handler, (uint8_t)(arg >> 8));
+	SD_SpiByte(handler, (uint8_t)(arg));
+	SD_SpiByte(handler, crc);
+
+	if(cmd == SD_CMD12)
+		SD_SpiByte(handler, 0xFF);	// Skip stuff byte
+
+	do {
+		if(handler->ErrCode == SD_ERR_BUS)
+			return 0xFF;	// No answer, the command did not go out
+		r1 = SD_SpiByte(handler, 0xFF);
+	}while((r1 & 0x80) && --retry);
+
+	return (handler->ErrCode == SD_ERR_BUS) ? 0xFF : r1;
+}
+
+static uint8_t SD_AppCommand(sd_handler_t *handler, uint8_t cmd, uint32_t arg){
+	SD_Command(handler, SD_CMD55, 0);
+	if(handler->ErrCode == SD_ERR_BUS)
+		return 0xFF;
+	return SD_Command(handler, cmd, arg);
+}
+
+static void SD_SpiCpltCallback(spi_handler_t *spi){
+	sd_handler_t *handler = (sd_handler_t *)spi->Owner;
+
+	switch(handler->Phase){
+		case SD_PHASE_IDLE:
+			break;
+
+		case SD_PHASE_TOKEN:
+			handler->Phase = SD_PHASE_DATA;
+			handler->XferPtr = handler->BlockQueue[handler->QueueHead];
+			handler->XferCount = SD_BLOCK_SIZE;
+			// fall through
+		case SD_PHASE_DATA:
+			if(handler->XferCount != 0){
+				uint8_t chunk = (handler->XferCount > 0xFF) ? 0xFF : (uint8_t)handler->XferCount;
+				uint8_t *ptr = handler->XferPtr;
+				handler->XferPtr += chunk;
+				handler->XferCount -= chunk;
+				if(handler->State == SD_STATE_WRITE_STREAM)
+					SD_Transmit(handler, ptr, chunk);
+				else
+					SD_Receive(handler, ptr, chunk);
+			}
+			else {
+				handler->Phase = SD_PHASE_CRC;
+				handler->Crc[0] = 0xFF;
+				handler->Crc[1] = 0xFF;
+				if(handler->State == SD_STATE_WRITE_STREAM)
+					SD_Transmit(handler, handler->Crc, 2);
+				else
+					SD_Receive(handler, handler->Crc, 2);
+			}
+			break;
+
+		case SD_PHASE_CRC:
+			if(handler->State == SD_STATE_WRITE_STREAM){
+				handler->Phase = SD_PHASE_DATA_RESP;
+				SD_Receive(handler, &handler->Resp, 1);
+			}
+			else {
+				SD_BlockDone(handler);
+			}
+			break;
+
+		case SD_PHASE_DATA_RESP:
+			if((handler->Resp & SD_DATA_RESP_MASK) == SD_DATA_RESP_ACCEPTED){
+				handler->Phase = SD_PHASE_BUSY;
+				handler->Retries = SD_POLL_RETRIES;
+				SD_Receive(handler, &handler->Resp, 1);
+			}
+			else {
+				SD_StreamError(handler, SD_ERR_DATA_REJECTED);
+			}
+			break;
+
+		case SD_PHASE_BUSY:
+			// Card holds DO low while programming
+			if(handler->Resp == 0xFF)
+				SD_BlockDone(handler);
+			else if(--handler->Retries)
+				SD_Receive(handler, &handler->Resp, 1);
+			else
+				handler->Deferred = 1;
+			break;
+
+		case SD_PHASE_TOKEN_WAIT:
+			if(handler->Resp == SD_TOKEN_START_BLOCK){
+				handler->Phase = SD_PHASE_DATA;
+				handler->XferPtr = handler->BlockQueue[handler->QueueHead];
+				handler->XferCount = SD_BLOCK_SIZE;
+				SD_SpiCpltCallback(spi);
+			}
+			else if(handler->Resp != 0xFF)
+				SD_StreamError(handler, SD_ERR_TOKEN);
+			else if(--handler->Retries)
+				SD_Receive(handler, &handler->Resp, 1);
+			else
+				handler->Deferred = 1;
+			break;
+	}
+}
+
+static void SD_StartBlock(sd_handler_t *handler){
+	handler->Deferred = 0;
+	if(handler->State == SD_STATE_WRITE_STREAM){
+		handler->Phase = SD_PHASE_TOKEN;
+		handler->Token = SD_TOKEN_START_MULTI;
+		SD_Transmit(handler, &handler->Token, 1);
+	}
+	else {
+		handler->Phase = SD_PHASE_TOKEN_WAIT;
+		handler->Retries = SD_POLL_RETRIES;
+		SD_Receive(handler, &handler->Resp, 1);
+	}
+}
+
+static void SD_BlockDone(sd_handler_t *handler){
+	uint8_t *block = handler->BlockQueue[handler->QueueHead];
+
+	handler->QueueHead ^= 1;
+	handler->QueueCount--;
+	handler->Phase = SD_PHASE_IDLE;
+
+	// Start next buffer before notifying, keeps the bus busy
+	if(handler->QueueCount != 0)
+		SD_StartBlock(handler);
+
+	if(handler->BlockCpltCallback != NULL)
+		handler->BlockCpltCallback(handler, block);
+}
+
+static void SD_StreamError(sd_handler_t *handler, sd_error_t err){
+	// CS stays low, the stream is closed by its Stop function
+	handler->Phase = SD_PHASE_IDLE;
+	handler->Deferred = 0;
+	handler->QueueCount = 0;
+	handler->ErrCode = err;
+	handler->Stream = handler->State;
+	handler->State = SD_STATE_ERROR;
+
+	if(handler->ErrorCallback != NULL)
+		handler->ErrorCallback(handler);
+}
+
+/* Asynchronous transfers: no completion will come for a refused one */
+static void SD_Transmit(sd_handler_t *handler, uint8_t *pData, uint8_t Size){
+	if(SPI_Transmit(handler->Spi, pData, Size) != HAL_OK)
+		SD_StreamError(handler, SD_ERR_BUS);
+}
+
+static void SD_Receive(sd_handler_t *handler, uint8_t *pData, uint8_t Size){
+	if(SPI_Receive(handler->Spi, pData, Size) != HAL_OK)
+		SD_StreamError(handler, SD_ERR_BUS);
+}
+
+hal_status_t SD_Init(sd_handler_t *handler){
+	if(handler == NULL || handler->Spi == NULL || handler->Init.CSGpio == NULL){
+		return HAL_ERROR;
+	}
+
+	hal_status_t retCode = HAL_OK;
+	uint8_t ocr[4];
+	uint8_t r1;
+	uint16_t timeout;
+	uint8_t i;
+
+	__HAL_LOCK(handler);
+	handler->State = SD_STATE_BUSY;
+	handler->Phase = SD_PHASE_IDLE;
+	handler->QueueCount = 0;
+	handler->QueueHead = 0;
+	handler->Type = SD_CARD_UNKNOWN;
+	handler->ErrCode = SD_ERR_NONE;
+
+	GPIO_SetPin(handler->Init.CSGpio, handler->Init.CSPin);
+	GPIO_PinMode(handler->Init.CSGpio, handler->Init.CSPin, GPIO_MODE_OUTPUT);
+
+	SD_Attach(handler);
+	SPI_SetClockPresc(handler->Spi, handler->Init.InitClock);
+
+	// At least 74 clocks with CS high to enter native mode
+	for(i = 0; i < 10; i++)
+		SD_SpiByte(handler, 0xFF);
+	if(handler->ErrCode == SD_ERR_BUS)
+		goto error;
+
+	SD_Select(handler);
+
+	i = 10;
+	do {
+		r1 = SD_Command(handler, SD_CMD0, 0);
+	}while(r1 != SD_R1_IDLE && handler->ErrCode != SD_ERR_BUS && --i);
+
+	if(r1 != SD_R1_IDLE){
+		SD_SetError(handler, SD_ERR_TIMEOUT);
+		goto error;
+	}
+
+	r1 = SD_Command(handler, SD_CMD8, 0x1AA);
+	if(handler->ErrCode == SD_ERR_BUS){
+		goto error;
+	}
+	else if(r1 & SD_R1_ILLEGAL_CMD){
+		handler->Type = SD_CARD_V1;
+	}
+	else {
+		for(i = 0; i < 4; i++)
+			ocr[i] = SD_SpiByte(handler, 0xFF);
+		if(ocr[3] != 0xAA){
+			SD_SetError(handler, SD_ERR_UNSUPPORTED);
+			goto error;
+		}
+		handler->Type = SD_CARD_V2;
+	}
+
+	// Wait card to leave idle state, up to one second
+	timeout = 1000;
+	do {
+		r1 = SD_AppCommand(handler, SD_ACMD41, (handler->Type == SD_CARD_V2) ? 0x40000000UL : 0);
+		if(r1 == 0 || handler->ErrCode == SD_ERR_BUS)
+			break;
+		_delay_ms(1);
+	}while(--timeout);
+
+	if(r1 != 0){
+		SD_SetError(handler, SD_ERR_TIMEOUT);
+		goto error;
+	}
+
+	if(handler->Type == SD_CARD_V2){
+		if(SD_Command(handler, SD_CMD58, 0) != 0){
+			SD_SetError(handler, SD_ERR_CMD);
+			goto error;
+		}
+		for(i = 0; i < 4; i++)
+			ocr[i] = SD_SpiByte(handler, 0xFF);
+		if(handler->ErrCode == SD_ERR_BUS)
+			goto error;
+		if(ocr[0] & 0x40)
+			handler->Type = SD_CARD_SDHC;	// CCS bit
+	}
+
+	if(handler->Type != SD_CARD_SDHC){
+		if(SD_Command(handler, SD_CMD16, SD_BLOCK_SIZE) != 0){
+			SD_SetError(handler, SD_ERR_CMD);
+			goto error;
+		}
+	}
+
+	SD_Deselect(handler);
+	SD_SpiByte(handler, 0xFF);
+	if(handler->ErrCode == SD_ERR_BUS)
+		goto error;
+	SPI_SetClockPresc(handler->Spi, handler->Init.Clock);
+	SD_Detach(handler);
+	handler->State = SD_STATE_READY;
+	__HAL_UNLOCK(handler);
+	return retCode;
+
+	error:
+	SD_Deselect(handler);
+	SD_SpiByte(handler, 0xFF);
+	SD_Detach(handler);
+	handler->State = SD_STATE_RESET;
+	__HAL_UNLOCK(handler);
+	return HAL_ERROR;
+}
+
+void SD_DeInit(sd_handler_t *handler){
+	SD_Deselect(handler);
+	GPIO_PinMode(handler->Init.CSGpio, handler->Init.CSPin, GPIO_MODE_INPUT_PULLUP);
+	SD_Detach(handler);
+	handler->Phase = SD_PHASE_IDLE;
+	handler->QueueCount = 0;
+	handler->State = SD_STATE_RESET;
+	__HAL_UNLOCK(handler);
+}
+
+sd_state_t SD_GetState(sd_handler_t *handler){
+	return handler->State;
+}
+
+sd_error_t SD_GetError(sd_handler_t *handler){
+	return handler->ErrCode;
+}
+
+hal_status_t SD_WriteStreamStart(sd_handler_t *handler, uint32_t Block, uint32_t PreErase){
+	if(handler->State != SD_STATE_READY){
+		return HAL_BUSY;
+	}
+
+	__HAL_LOCK(handler);
+	handler->State = SD_STATE_BUSY;
+	handler->ErrCode = SD_ERR_NONE;
+	SD_Attach(handler);
+	SD_Select(handler);
+
+	if(PreErase != 0){
+		// Hint only, failures are not fatal
+		SD_AppCommand(handler, SD_ACMD23, PreErase);
+	}
+
+	if(SD_Command(handler, SD_CMD25, (handler->Type == SD_CARD_SDHC) ? Block : (Block * SD_BLOCK_SIZE)) != 0){
+		SD_Deselect(handler);
+		SD_Detach(handler);
+		SD_SetError(handler, SD_ERR_CMD);
+		handler->State = SD_STATE_READY;
+		__HAL_UNLOCK(handler);
+		return HAL_ERROR;
+	}
+
+	SD_SpiByte(handler, 0xFF);	// Nwr gap before first token
+	if(handler->ErrCode == SD_ERR_BUS){
+		// The card is in a write, the stream is left open for SD_WriteStreamStop
+		handler->Stream = SD_STATE_WRITE_STREAM;
+		handler->State = SD_STATE_ERROR;
+		__HAL_UNLOCK(handler);
+		return HAL_ERROR;
+	}
+	handler->Phase = SD_PHASE_IDLE;
+	handler->QueueHead = 0;
+	handler->QueueCount = 0;
+	handler->State = SD_STATE_WRITE_STREAM;
+	__HAL_UNLOCK(handler);
+	return HAL_OK;
+}
+
+hal_status_t SD_WriteStreamStop(sd_handler_t *handler){
+	if(handler->State != SD_STATE_WRITE_STREAM &&
+		!(handler->State == SD_STATE_ERROR && handler->Stream == SD_STATE_WRITE_STREAM)){
+		return HAL_ERROR;
+	}
+	if(handler->QueueCount != 0){
+		return HAL_BUSY;
+	}
+
+	sd_error_t err = handler->ErrCode;
+
+	__HAL_LOCK(handler);
+	handler->State = SD_STATE_BUSY;
+	handler->ErrCode = SD_ERR_NONE;
+	SD_SpiByte(handler, SD_TOKEN_STOP_TRAN);
+	SD_SpiByte(handler, 0xFF);
+	if(!SD_WaitReady(handler))
+		SD_SetError(handler, SD_ERR_TIMEOUT);
+	SD_Deselect(handler);
+	SD_SpiByte(handler, 0xFF);
+	SD_Detach(handler);
+	if(handler->ErrCode == SD_ERR_NONE)
+		handler->ErrCode = err;		// Stream error, if any
+	handler->State = SD_STATE_READY;
+	__HAL_UNLOCK(handler);
+	return (handler->ErrCode == SD_ERR_NONE) ? HAL_OK : HAL_ERROR;
+}
+
+hal_status_t SD_ReadStreamStart(sd_handler_t *handler, uint32_t Block){
+	if(handler->State != SD_STATE_READY){
+		return HAL_BUSY;
+	}
+
+	__HAL_LOCK(handler);
+	handler->State = SD_STATE_BUSY;
+	handler->ErrCode = SD_ERR_NONE;
+	SD_Attach(handler);
+	SD_Select(handler);
+
+	if(SD_Command(handler, SD_CMD18, (handler->Type == SD_CARD_SDHC) ? Block : (Block * SD_BLOCK_SIZE)) != 0){
+		SD_Deselect(handler);
+		SD_Detach(handler);
+		SD_SetError(handler, SD_ERR_CMD);
+		handler->State = SD_STATE_READY;
+		__HAL_UNLOCK(handler);
+		return HAL_ERROR;
+	}
+
+	handler->Phase = SD_PHASE_IDLE;
+	handler->QueueHead = 0;
+	handler->QueueCount = 0;
+	handler->State = SD_STATE_READ_STREAM;
+	__HAL_UNLOCK(handler);
+	return HAL_OK;
+}
+
+hal_status_t SD_ReadStreamStop(sd_handler_t *handler){
+	if(handler->State != SD_STATE_READ_STREAM &&
+		!(handler->State == SD_STATE_ERROR && handler->Stream == SD_STATE_READ_STREAM)){
+		return HAL_ERROR;
+	}
+	if(handler->QueueCount != 0){
+		return HAL_BUSY;
+	}
+
+	sd_error_t err = handler->ErrCode;
+
+	__HAL_LOCK(handler);
+	handler->State = SD_STATE_BUSY;
+	handler->ErrCode = SD_ERR_NONE;
+	SD_Command(handler, SD_CMD12, 0);
+	if(!SD_WaitReady(handler))
+		SD_SetError(handler, SD_ERR_TIMEOUT);
+	SD_Deselect(handler);
+	SD_SpiByte(handler, 0xFF);
+	SD_Detach(handler);
+	if(handler->ErrCode == SD_ERR_NONE)
+		handler->ErrCode = err;		// Stream error, if any
+	handler->State = SD_STATE_READY;
+	__HAL_UNLOCK(handler);
+	return (handler->ErrCode == SD_ERR_NONE) ? HAL_OK : HAL_ERROR;
+}
+
+hal_status_t SD_QueueBlock(sd_handler_t *handler, uint8_t *pBlock){
+	if(pBlock == NULL){
+		return HAL_ERROR;
+	}
+	if(handler->State != SD_STATE_WRITE_STREAM && handler->State != SD_STATE_READ_STREAM){
+		return HAL_ERROR;
+	}
+
+	hal_status_t retCode = HAL_BUSY;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->QueueCount < 2){
+			handler->BlockQueue[(handler->QueueHead + handler->QueueCount) & 0x01] = pBlock;
+			handler->QueueCount++;
+			if(handler->Phase == SD_PHASE_IDLE)
+				SD_StartBlock(handler);
+			retCode = (handler->State == SD_STATE_ERROR) ? HAL_ERROR : HAL_OK;
+		}
+	}
+
+	return retCode;
+}
+
+void SD_PollHandler(sd_handler_t *handler){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->Deferred){
+			handler->Deferred = 0;
+			handler->Retries = SD_POLL_RETRIES;
+			SD_Receive(handler, &handler->Resp, 1);
+		}
+	}
+}
+
+void SD_RegisterBlockCallback(sd_handler_t *handler, SD_BlockCallback_t Callback){
+	handler->BlockCpltCallback = Callback;
+}
+
+void SD_RegisterErrorCallback(sd_handler_t *handler, SD_Callback_t Callback){
+	handler->ErrorCallback = Callback;
+}
+
+void SD_UnRegisterCallback(sd_handler_t *handler, sd_callback_id_t CallbackID){
+	switch (CallbackID) {
+		case SD_BLOCK_COMPLETE_CB_ID:
+			handler->BlockCpltCallback = NULL;
+			break;
+
+		case SD_ERROR_CB_ID:
+			handler->ErrorCallback = NULL;
+			break;
+
+		default:
+			break;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,280 @@
+/**
+ * @file hal_sd.h
+ * @author Matheus Alencar Nascimento (matt-alencar)
+ * @brief Header file of SD/MMC card (SPI mode) driver.
+ **************************************************************************
+ * @copyright MIT License.
+ *
+ */
+
+#ifndef _SD_DRIVER_H_
+#define _SD_DRIVER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "hal_spi.h"
+
+
+#define SD_BLOCK_SIZE				512U
+
+/**
+ * @brief Number of busy/token polling bytes clocked from the SPI IRQ before
+ *        the wait is deferred to SD_PollHandler
+ */
+#ifndef SD_POLL_RETRIES
+	#define SD_POLL_RETRIES			16
+#endif
+
+
+/**
+ * @brief SD card type
+ */
+typedef enum {
+	SD_CARD_UNKNOWN,
+	SD_CARD_V1,					/*!< SD version 1.x, byte addressing */
+	SD_CARD_V2,					/*!< SD version 2.0 standard capacity, byte addressing */
+	SD_CARD_SDHC				/*!< SDHC/SDXC, block addressing */
+}sd_card_type_t;
+
+/**
+ * @brief SD state machine: driver states definition
+ */
+typedef enum {
+	SD_STATE_RESET,				/*!< Card not yet initialized */
+	SD_STATE_READY,				/*!< Card idle and ready for a new stream */
+	SD_STATE_BUSY,				/*!< Card command ongoing */
+	SD_STATE_WRITE_STREAM,		/*!< CMD25 multiple block write stream is open */
+	SD_STATE_READ_STREAM,		/*!< CMD18 multiple block read stream is open */
+	SD_STATE_ERROR				/*!< Stream aborted by an error, must be closed by its Stop function */
+}sd_state_t;
+
+/**
+ * @brief SD block transfer phases
+ */
+typedef enum {
+	SD_PHASE_IDLE,				/*!< No block being transferred */
+	SD_PHASE_TOKEN,				/*!< Sending start block token */
+	SD_PHASE_TOKEN_WAIT,		/*!< Waiting for start block token */
+	SD_PHASE_DATA,				/*!< Block payload */
+	SD_PHASE_CRC,				/*!< Block CRC */
+	SD_PHASE_DATA_RESP,			/*!< Waiting for data response token */
+	SD_PHASE_BUSY				/*!< Waiting for card to finish programming */
+}sd_phase_t;
+
+/**
+ * @brief SD driver errors
+ */
+typedef enum {
+	SD_ERR_NONE,
+	SD_ERR_TIMEOUT,				/*!< Card did not answer in time */
+	SD_ERR_CMD,					/*!< Command rejected (R1 error bits) */
+	SD_ERR_UNSUPPORTED,			/*!< Card version not supported */
+	SD_ERR_TOKEN,				/*!< Read data error token received */
+	SD_ERR_DATA_REJECTED,		/*!< Write data response is CRC or write error */
+	SD_ERR_BUS					/*!< SPI bus refused a transfer */
+}sd_error_t;
+
+/**
+ * @brief SD Callback IDs
+ */
+typedef enum {
+	SD_BLOCK_COMPLETE_CB_ID,
+	SD_ERROR_CB_ID
+}sd_callback_id_t;
+
+/**
+ * @brief Structure definition of SD initialization
+ */
+typedef struct {
+	gpio_t *CSGpio;				/*!< Chip select GPIO port */
+	gpio_pin_t CSPin;			/*!< Chip select GPIO pin */
+	spi_clock_t InitClock;		/*!< SPI clock during identification, must be 100-400kHz */
+	spi_clock_t Clock;			/*!< SPI clock after identification, e.g. SPI_CLOCK_DIV2 */
+}sd_init_t;
+
+/**
+ * @brief SD handle Structure definition
+ */
+typedef struct _sd_handler {
+	spi_handler_t *Spi;												/*!< SPI bus handler, must be initialized as master */
+	sd_init_t Init;													/*!< SD required parameters */
+	hal_lock_t Lock;												/*!< SD locking object */
+	volatile sd_state_t State;										/*!< SD State */
+	volatile sd_error_t ErrCode;									/*!< Last error */
+	sd_state_t Stream;												/*!< Stream left open by an error (SD_STATE_ERROR) */
+	sd_card_type_t Type;											/*!< Detected card type */
+
+	volatile sd_phase_t Phase;										/*!< Block transfer phase */
+	volatile uint8_t Retries;										/*!< Polling bytes left before deferring */
+	volatile uint8_t Deferred;										/*!< Polling deferred to SD_PollHandler */
+	uint8_t Token;													/*!< Start block token */
+	uint8_t Resp;													/*!< Last polled byte */
+	uint8_t Crc[2];													/*!< Block CRC (ignored) */
+
+	uint8_t *XferPtr;												/*!< Block payload pointer */
+	uint16_t XferCount;												/*!< Block payload remaining bytes */
+
+	uint8_t *BlockQueue[2];											/*!< Double buffer block queue */
+	volatile uint8_t QueueHead;										/*!< Block being transferred */
+	volatile uint8_t QueueCount;									/*!< Queued blocks */
+
+	void *SpiOwner;													/*!< SPI handler owner saved while the card is selected */
+	SPI_Callback_t SpiTxCpltCallback;								/*!< SPI handler TX complete callback saved while the card is selected */
+	SPI_Callback_t SpiRxCpltCallback;								/*!< SPI handler RX complete callback saved while the card is selected */
+	SPI_Callback_t SpiTxRxCpltCallback;								/*!< SPI handler TX/RX complete callback saved while the card is selected */
+	uint8_t SpiDummyByte;											/*!< SPI handler dummy byte saved while the card is selected */
+
+	void (*BlockCpltCallback)(struct _sd_handler *handler, uint8_t *pBlock);	/*!< Block done, buffer can be reused */
+	void (*ErrorCallback)(struct _sd_handler *handler);						/*!< Stream error callback */
+}sd_handler_t;
+
+
+/**
+ * @brief SD Callback TypeDef
+ */
+typedef void (*SD_Callback_t)(sd_handler_t *handler);
+typedef void (*SD_BlockCallback_t)(sd_handler_t *handler, uint8_t *pBlock);
+
+
+/**
+ * @brief Run card identification (CMD0, CMD8, ACMD41, CMD58, CMD16)
+ *        and switch the SPI bus to the high speed clock
+ * @note This function blocks, global interrupts must be enabled
+ *
+ * @param handler SD Handler Pointer
+ * @return HAL Status
+ */
+hal_status_t SD_Init(sd_handler_t *handler);
+
+
+/**
+ * @brief Deinitialize SD driver and release chip select pin
+ *
+ * @param handler SD Handler Pointer
+ */
+void SD_DeInit(sd_handler_t *handler);
+
+
+/**
+ * @brief Return the SD driver state
+ *
+ * @param handler SD Handler Pointer
+ * @return SD State
+ */
+sd_state_t SD_GetState(sd_handler_t *handler);
+
+
+/**
+ * @brief Return the last SD error
+ *
+ * @param handler SD Handler Pointer
+ * @return SD Error
+ */
+sd_error_t SD_GetError(sd_handler_t *handler);
+
+
+/**
+ * @brief Open a multiple block write stream (CMD25)
+ * @note Chip select stays low and the SPI bus (callbacks, 0xFF dummy byte) is reserved
+ *       until the stream is stopped, the previous ones are restored then
+ *
+ * @param handler SD Handler Pointer
+ * @param Block First block number
+ * @param PreErase Number of blocks that will be written (ACMD23 hint), 0 to skip
+ * @return HAL Status
+ */
+hal_status_t SD_WriteStreamStart(sd_handler_t *handler, uint32_t Block, uint32_t PreErase);
+
+
+/**
+ * @brief Close the multiple block write stream (Stop Tran token)
+ * @note Blocks until card finishes programming. Also closes a write stream
+ *       aborted by an error (SD_STATE_ERROR), HAL_ERROR is then returned.
+ *
+ * @param handler SD Handler Pointer
+ * @return HAL Status: HAL_BUSY if queued blocks are still being transferred
+ */
+hal_status_t SD_WriteStreamStop(sd_handler_t *handler);
+
+
+/**
+ * @brief Open a multiple block read stream (CMD18)
+ * @note Chip select stays low and the SPI bus (callbacks, 0xFF dummy byte) is reserved
+ *       until the stream is stopped, the previous ones are restored then
+ *
+ * @param handler SD Handler Pointer
+ * @param Block First block number
+ * @return HAL Status
+ */
+hal_status_t SD_ReadStreamStart(sd_handler_t *handler, uint32_t Block);
+
+
+/**
+ * @brief Close the multiple block read stream (CMD12)
+ * @note Also closes a read stream aborted by an error (SD_STATE_ERROR),
+ *       HAL_ERROR is then returned.
+ *
+ * @param handler SD Handler Pointer
+ * @return HAL Status: HAL_BUSY if queued blocks are still being transferred
+ */
+hal_status_t SD_ReadStreamStop(sd_handler_t *handler);
+
+
+/**
+ * @brief Queue one 512 bytes buffer on the open stream
+ * @note Two buffers can be queued: while the first one is clocked out/in,
+ *       the application fills/consumes the other one. BlockCpltCallback is
+ *       called with the buffer pointer once its block is done.
+ *
+ * @param handler SD Handler Pointer
+ * @param pBlock 512 bytes buffer, must remain valid until BlockCpltCallback
+ * @return HAL Status: HAL_BUSY if both buffers are queued
+ */
+hal_status_t SD_QueueBlock(sd_handler_t *handler, uint8_t *pBlock);
+
+
+/**
+ * @brief Deferred polling handler
+ * @note Should be called periodically (timer IRQ or main loop). Resumes the
+ *       card busy or start token wait once SD_POLL_RETRIES were exhausted
+ *       from the SPI IRQ.
+ *
+ * @param handler SD Handler Pointer
+ */
+void SD_PollHandler(sd_handler_t *handler);
+
+
+/**
+ * @brief Register block complete callback
+ *
+ * @param handler SD Handler Pointer
+ * @param Callback Pointer to the Callback function
+ */
+void SD_RegisterBlockCallback(sd_handler_t *handler, SD_BlockCallback_t Callback);
+
+
+/**
+ * @brief Register error callback
+ *
+ * @param handler SD Handler Pointer
+ * @param Callback Pointer to the Callback function
+ */
+void SD_RegisterErrorCallback(sd_handler_t *handler, SD_Callback_t Callback);
+
+
+/**
+ * @brief Unregister user callback
+ *
+ * @param handler SD Handler Pointer
+ * @param CallbackID Callback ID
+ */
+void SD_UnRegisterCallback(sd_handler_t *handler, sd_callback_id_t CallbackID);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SD_DRIVER_H_ */
\ No newline at end of file
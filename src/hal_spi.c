@@ -30,6 +30,129 @@ static hal_status_t SPI_SetupGPIO(spi_handler_t *handler){
 }
 
 
+static inline uint8_t SPI_SegmentByte(spi_handler_t *handler, spi_segment_t *seg, uint16_t pos){
+	switch(seg->Mode){
+		case SPI_SEG_TX:
+		case SPI_SEG_TXRX:
+			return seg->pTxData[pos];
+		case SPI_SEG_FILL:
+			return seg->Fill;
+		default:
+			return handler->DummyByte;
+	}
+}
+
+static void SPI_SegmentSetup(spi_handler_t *handler, spi_segment_t *seg){
+	uint8_t lsb_first = handler->Init.BitOrder;
+
+	if(seg->Flags & SPI_SEG_FLAG_LSB_FIRST)
+		lsb_first = SPI_LSB_FIRST;
+	else if(seg->Flags & SPI_SEG_FLAG_MSB_FIRST)
+		lsb_first = SPI_MSB_FIRST;
+
+	// Shift register is idle between bytes, DORD can be switched safely
+	MODIFY_REG(handler->Instance->SPCR_REG, _BV(DORD), (lsb_first << DORD));
+
+	handler->SegLen = (seg->Flags & SPI_SEG_FLAG_WORD16) ? (seg->Size << 1) : seg->Size;
+	// Words are stored little endian, swap bytes to clock them out MSB first
+	handler->SegSwap = (seg->Flags & SPI_SEG_FLAG_WORD16) ? 0x01 : 0x00;
+}
+
+static void SPI_ChainHandler(spi_handler_t *handler, uint8_t recv_data){
+	spi_segment_t *seg = &handler->SegPtr[handler->SegIndex];
+	uint16_t pos = handler->SegPos;
+
+	if(seg->Mode == SPI_SEG_RX || seg->Mode == SPI_SEG_TXRX)
+		seg->pRxData[pos ^ handler->SegSwap] = recv_data;
+
+	if(++pos >= handler->SegLen){
+		pos = 0;
+		if(++handler->SegIndex >= handler->SegCount){
+			MODIFY_REG(handler->Instance->SPCR_REG, _BV(DORD), (handler->Init.BitOrder << DORD));
+			handler->State = SPI_STATE_READY;
+			if(handler->SegPtr != &handler->SegSingle){
+				if(handler->ChainCpltCallback != NULL)
+					handler->ChainCpltCallback(handler);
+			}
+			else if(seg->Mode == SPI_SEG_FILL || seg->Mode == SPI_SEG_TX){
+				if(handler->TxCpltCallback != NULL)
+					handler->TxCpltCallback(handler);
+			}
+			else if(seg->Mode == SPI_SEG_TXRX){
+				if(handler->TxRxCpltCallback != NULL)
+					handler->TxRxCpltCallback(handler);
+			}
+			else {
+				if(handler->RxCpltCallback != NULL)
+					handler->RxCpltCallback(handler);
+			}
+			return;
+		}
+		seg++;
+		SPI_SegmentSetup(handler, seg);
+	}
+
+	handler->SegPos = pos;
+	handler->Instance->SPDR_REG = SPI_SegmentByte(handler, seg, pos ^ handler->SegSwap);
+}
+
+/* Handler locked and READY */
+static void SPI_ChainFire(spi_handler_t *handler, spi_segment_t *pSegments, uint8_t Count){
+	handler->SegPtr = pSegments;
+	handler->SegCount = Count;
+	handler->SegIndex = 0;
+	handler->SegPos = 0;
+
+	handler->State = SPI_STATE_BUSY_CHAIN;
+	handler->ErrorCode = 0;
+	handler->Instance->SPCR_REG |= (_BV(SPIE) | _BV(SPE));
+	SPI_SegmentSetup(handler, pSegments);
+	handler->Instance->SPDR_REG = SPI_SegmentByte(handler, pSegments, handler->SegSwap); // Fire up transmission
+}
+
+static hal_status_t SPI_StartChain(spi_handler_t *handler, spi_segment_t *pSegments, uint8_t Count){
+	hal_status_t errCode = HAL_OK;
+
+	__HAL_LOCK(handler);
+	if(handler->State != SPI_STATE_READY){
+		errCode = HAL_BUSY;
+		goto error;
+	}
+
+	SPI_ChainFire(handler, pSegments, Count);
+
+	error:
+	__HAL_UNLOCK(handler);
+	return errCode;
+}
+
+static hal_status_t SPI_StartSingle(spi_handler_t *handler, spi_seg_mode_t Mode, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint8_t Fill, uint8_t Flags){
+	hal_status_t errCode = HAL_OK;
+
+	if((Flags & SPI_SEG_FLAG_WORD16) && Size > SPI_SEG_WORD16_MAX){
+		return HAL_ERROR;
+	}
+
+	// SegSingle belongs to the running transfer until the handler is READY
+	__HAL_LOCK(handler);
+	if(handler->State != SPI_STATE_READY){
+		errCode = HAL_BUSY;
+		goto error;
+	}
+
+	handler->SegSingle.Mode = Mode;
+	handler->SegSingle.pTxData = pTxData;
+	handler->SegSingle.pRxData = pRxData;
+	handler->SegSingle.Size = Size;
+	handler->SegSingle.Fill = Fill;
+	handler->SegSingle.Flags = Flags;
+	SPI_ChainFire(handler, &handler->SegSingle, 1);
+
+	error:
+	__HAL_UNLOCK(handler);
+	return errCode;
+}
+
 void SPI_IRQHandler(spi_handler_t *handler){
 	// uint8_t error = handler->Instance->SPSR_REG & _BV(WCOL);
 	uint8_t recv_data = handler->Instance->SPDR_REG;
@@ -38,6 +161,9 @@ void SPI_IRQHandler(spi_handler_t *handler){
 	if(handler->State == SPI_STATE_ABORT){
 		handler->State = SPI_STATE_READY;
 	}
+	else if(handler->State == SPI_STATE_BUSY_CHAIN){
+		SPI_ChainHandler(handler, recv_data);
+	}
 	else if(handler->State == SPI_STATE_BUSY_RX){
 		(*handler->RxBuffPtr) = recv_data;
 		handler->RxBuffPtr++;
@@ -49,7 +175,7 @@ void SPI_IRQHandler(spi_handler_t *handler){
 				handler->RxCpltCallback(handler);
 		}
 		else {
-			handler->Instance->SPDR_REG = 0;	// Send dummy byte on next transmit
+			handler->Instance->SPDR_REG = handler->DummyByte;	// Send dummy byte on next transmit
 		}
 	}
 	else if (handler->State == SPI_STATE_BUSY_TX_RX){
@@ -69,10 +195,12 @@ void SPI_IRQHandler(spi_handler_t *handler){
 		}
 	}
 	else if(handler->State == SPI_STATE_BUSY_TX){
-		handler->Instance->SPDR_REG = (*++handler->TxBuffPtr);
-		handler->TxCount--;
-
-		if(handler->TxCount == 0){
+		if(handler->TxCount != 0){
+			handler->Instance->SPDR_REG = (*++handler->TxBuffPtr);
+			handler->TxCount--;
+		}
+		else {
+			// Last byte is already out of the shift register, safe to release CS
 			handler->State = SPI_STATE_READY;
 			if(handler->TxCpltCallback != NULL)
 				handler->TxCpltCallback(handler);
@@ -89,6 +217,7 @@ hal_status_t SPI_Init(spi_handler_t *handler){
 	}
 
 	__HAL_LOCK(handler);
+	handler->DummyByte = 0;
 
 	errCode = SPI_SetupGPIO(handler);
 	if(errCode == HAL_ERROR)
@@ -129,6 +258,23 @@ uint8_t SPI_GetError(spi_handler_t *handler){
 	return handler->ErrorCode;
 }
 
+hal_status_t SPI_SetClockPresc(spi_handler_t *handler, spi_clock_t ClockPresc){
+	if(handler->State != SPI_STATE_READY){
+		return HAL_BUSY;
+	}
+
+	__HAL_LOCK(handler);
+	handler->Init.ClockPresc = ClockPresc;
+	MODIFY_REG(handler->Instance->SPCR_REG, (_BV(SPR1) | _BV(SPR0)), (ClockPresc & 0x03));
+	MODIFY_REG(handler->Instance->SPSR_REG, _BV(SPI2X), ((ClockPresc & 0x04) >> 2));
+	__HAL_UNLOCK(handler);
+	return HAL_OK;
+}
+
+void SPI_SetDummyByte(spi_handler_t *handler, uint8_t DummyByte){
+	handler->DummyByte = DummyByte;
+}
+
 hal_status_t SPI_TransmitReceive(spi_handler_t *handler, uint8_t *pTxData, uint8_t *pRxData, uint8_t Size){
 	hal_status_t errCode = HAL_OK;
 
@@ -215,15 +361,72 @@ hal_status_t SPI_Receive(spi_handler_t *handler, uint8_t *pData, uint8_t Size){
 	handler->State = SPI_STATE_BUSY_RX;
 	handler->ErrorCode = 0;
 	handler->Instance->SPCR_REG |= (_BV(SPIE) | _BV(SPE));
-	handler->Instance->SPDR_REG = 0; // Fire up transmission
+	handler->Instance->SPDR_REG = handler->DummyByte; // Fire up transmission
 
 	error:
 	__HAL_UNLOCK(handler);
 	return errCode;
 }
 
+hal_status_t SPI_TransmitFill(spi_handler_t *handler, uint8_t Fill, uint16_t Size){
+	if(Size == 0){
+		return HAL_ERROR;
+	}
+	return SPI_StartSingle(handler, SPI_SEG_FILL, NULL, NULL, Size, Fill, 0);
+}
+
+hal_status_t SPI_ReceiveDiscard(spi_handler_t *handler, uint16_t Size){
+	if(Size == 0){
+		return HAL_ERROR;
+	}
+	return SPI_StartSingle(handler, SPI_SEG_DISCARD, NULL, NULL, Size, 0, 0);
+}
+
+hal_status_t SPI_TransmitWords(spi_handler_t *handler, uint16_t *pData, uint16_t Count, uint8_t Flags){
+	if(pData == NULL || Count == 0){
+		return HAL_ERROR;
+	}
+	return SPI_StartSingle(handler, SPI_SEG_TX, (uint8_t*)pData, NULL, Count, 0, Flags | SPI_SEG_FLAG_WORD16);
+}
+
+hal_status_t SPI_ReceiveWords(spi_handler_t *handler, uint16_t *pData, uint16_t Count, uint8_t Flags){
+	if(pData == NULL || Count == 0){
+		return HAL_ERROR;
+	}
+	return SPI_StartSingle(handler, SPI_SEG_RX, NULL, (uint8_t*)pData, Count, 0, Flags | SPI_SEG_FLAG_WORD16);
+}
+
+hal_status_t SPI_TransmitReceiveWords(spi_handler_t *handler, uint16_t *pTxData, uint16_t *pRxData, uint16_t Count, uint8_t Flags){
+	if(pTxData == NULL || pRxData == NULL || Count == 0){
+		return HAL_ERROR;
+	}
+	return SPI_StartSingle(handler, SPI_SEG_TXRX, (uint8_t*)pTxData, (uint8_t*)pRxData, Count, 0, Flags | SPI_SEG_FLAG_WORD16);
+}
+
+hal_status_t SPI_TransferChain(spi_handler_t *handler, spi_segment_t *pSegments, uint8_t Count){
+	uint8_t i;
+
+	if(pSegments == NULL || Count == 0){
+		return HAL_ERROR;
+	}
+
+	for(i = 0; i < Count; i++){
+		spi_segment_t *seg = &pSegments[i];
+		if(seg->Size == 0)
+			return HAL_ERROR;
+		if((seg->Flags & SPI_SEG_FLAG_WORD16) && seg->Size > SPI_SEG_WORD16_MAX)
+			return HAL_ERROR;
+		if((seg->Mode == SPI_SEG_TX || seg->Mode == SPI_SEG_TXRX) && seg->pTxData == NULL)
+			return HAL_ERROR;
+		if((seg->Mode == SPI_SEG_RX || seg->Mode == SPI_SEG_TXRX) && seg->pRxData == NULL)
+			return HAL_ERROR;
+	}
+
+	return SPI_StartChain(handler, pSegments, Count);
+}
+
 hal_status_t SPI_Abort(spi_handler_t *handler){
-	if(handler->State == SPI_STATE_BUSY_RX || handler->State == SPI_STATE_BUSY_TX || handler->State == SPI_STATE_BUSY_TX_RX){
+	if(handler->State == SPI_STATE_BUSY_RX || handler->State == SPI_STATE_BUSY_TX || handler->State == SPI_STATE_BUSY_TX_RX || handler->State == SPI_STATE_BUSY_CHAIN){
 		handler->State = SPI_STATE_ABORT;
 		uint8_t timeout = 10;
 		do {
@@ -250,6 +453,10 @@ void SPI_RegisterCallback(spi_handler_t *handler, spi_callback_id_t CallbackID,
 		case SPI_TXRX_COMPLETE_CB_ID:
 			handler->TxRxCpltCallback = Callback;
 		break;
+
+		case SPI_CHAIN_COMPLETE_CB_ID:
+			handler->ChainCpltCallback = Callback;
+		break;
 		
 		default:
 			break;
@@ -269,6 +476,10 @@ void SPI_UnRegisterCallback(spi_handler_t *handler, spi_callback_id_t CallbackID
 		case SPI_TXRX_COMPLETE_CB_ID:
 			handler->TxRxCpltCallback = NULL;
 		break;
+
+		case SPI_CHAIN_COMPLETE_CB_ID:
+			handler->ChainCpltCallback = NULL;
+		break;
 		
 		default:
 			break;
@@ -7,7 +7,9 @@ extern "C" {
 
 #include "hal_def.h"
 #include "hal_gpio.h"
+#ifndef HAL_HOST
 #include <util/delay.h>
+#endif
 
 
 /**
@@ -68,6 +70,7 @@ typedef enum {
     SPI_STATE_BUSY_TX_RX,
     SPI_STATE_ERROR,
     SPI_STATE_ABORT,
+    SPI_STATE_BUSY_CHAIN,
 }spi_state_t;
 
 /**
@@ -87,10 +90,50 @@ typedef enum {
 typedef enum {
     SPI_TX_COMPLETE_CB_ID,
     SPI_RX_COMPLETE_CB_ID,
-    SPI_TXRX_COMPLETE_CB_ID
+    SPI_TXRX_COMPLETE_CB_ID,
+    SPI_CHAIN_COMPLETE_CB_ID
 }spi_callback_id_t;
 
 
+/**
+ * @brief SPI Transfer Segment Mode
+ * 
+ */
+typedef enum {
+    SPI_SEG_TX,         /*!< Transmit from buffer, received bytes are dropped */
+    SPI_SEG_RX,         /*!< Receive into buffer, dummy byte is transmitted */
+    SPI_SEG_TXRX,       /*!< Full duplex transfer */
+    SPI_SEG_FILL,       /*!< Transmit Fill byte Size times, no buffer needed */
+    SPI_SEG_DISCARD,    /*!< Clock Size bytes with dummy byte, received bytes are dropped */
+}spi_seg_mode_t;
+
+
+/**
+ * @brief SPI Transfer Segment Flags
+ * 
+ */
+#define SPI_SEG_FLAG_WORD16     0x01    /*!< Buffers hold uint16_t words clocked MSB byte first, Size counts words */
+#define SPI_SEG_FLAG_MSB_FIRST  0x02    /*!< Force MSB first bit order (DORD) during the segment */
+#define SPI_SEG_FLAG_LSB_FIRST  0x04    /*!< Force LSB first bit order (DORD) during the segment */
+
+#define SPI_SEG_WORD16_MAX      0x7FFF  /*!< Largest word count of a WORD16 segment, its byte length must fit 16 bits */
+
+
+/**
+ * @brief SPI Transfer Segment, a chained transaction is an array of segments
+ * @note Without bit order flags the segment uses Init.BitOrder
+ * 
+ */
+typedef struct {
+    spi_seg_mode_t Mode;
+    uint8_t *pTxData;
+    uint8_t *pRxData;
+    uint16_t Size;
+    uint8_t Fill;
+    uint8_t Flags;
+}spi_segment_t;
+
+
 /**
  * @brief SPI Init Struct
  * 
@@ -119,10 +162,21 @@ typedef struct _spi_handler {
     volatile uint8_t *RxBuffPtr;
     uint8_t RxBuffSize;
     volatile uint8_t RxCount;
+    uint8_t DummyByte;
+
+    spi_segment_t *SegPtr;
+    spi_segment_t SegSingle;
+    uint8_t SegCount;
+    volatile uint8_t SegIndex;
+    volatile uint16_t SegPos;
+    uint16_t SegLen;
+    uint8_t SegSwap;
 
     void (*TxCpltCallback)(struct _spi_handler *handler);
     void (*RxCpltCallback)(struct _spi_handler *handler);
     void (*TxRxCpltCallback)(struct _spi_handler *handler);
+    void (*ChainCpltCallback)(struct _spi_handler *handler);
+    void *Owner;    // Driver currently using the completion callbacks, their dispatch context
 
     hal_lock_t Lock;
     volatile spi_state_t State;
@@ -140,9 +194,18 @@ void SPI_DeInit(spi_handler_t *handler);
 spi_state_t SPI_GetState(spi_handler_t *handler);
 uint8_t SPI_GetError(spi_handler_t *handler);
 
+hal_status_t SPI_SetClockPresc(spi_handler_t *handler, spi_clock_t ClockPresc);
+void SPI_SetDummyByte(spi_handler_t *handler, uint8_t DummyByte);
+
 hal_status_t SPI_TransmitReceive(spi_handler_t *handler, uint8_t *pTxData, uint8_t *pRxData, uint8_t Size);
 hal_status_t SPI_Receive(spi_handler_t *handler, uint8_t *pData, uint8_t Size);
 hal_status_t SPI_Transmit(spi_handler_t *handler, uint8_t *pData, uint8_t Size);
+hal_status_t SPI_TransmitFill(spi_handler_t *handler, uint8_t Fill, uint16_t Size);
+hal_status_t SPI_ReceiveDiscard(spi_handler_t *handler, uint16_t Size);
+hal_status_t SPI_TransmitWords(spi_handler_t *handler, uint16_t *pData, uint16_t Count, uint8_t Flags);
+hal_status_t SPI_ReceiveWords(spi_handler_t *handler, uint16_t *pData, uint16_t Count, uint8_t Flags);
+hal_status_t SPI_TransmitReceiveWords(spi_handler_t *handler, uint16_t *pTxData, uint16_t *pRxData, uint16_t Count, uint8_t Flags);
+hal_status_t SPI_TransferChain(spi_handler_t *handler, spi_segment_t *pSegments, uint8_t Count);
 hal_status_t SPI_Abort(spi_handler_t *handler);
 
 void SPI_RegisterCallback(spi_handler_t *handler, spi_callback_id_t CallbackID, SPI_Callback_t Callback);
@@ -0,0 +1,445 @@
+/**
+ * @file hal_spi_flash.c
+ * @author Matheus Alencar Nascimento (matt-alencar)
+ * @brief This file provides firmware functions to manage SPI NOR Flash
+ *        memories (W25Qxx / AT25xx family) on top of SPI HAL driver:
+ *           + Initialization and de-initialization functions
+ *           + Operation functions
+ *             ++ Streamed fast read of any length
+ *             ++ Page program with one page queued behind the busy cycle
+ *             ++ Sector, block and chip erase
+ *           + State functions
+ *             ++ Non-blocking status register polling
+ *
+ **************************************************************************
+ * @copyright MIT License.
+ *
+ */
+
+#include "hal_spi_flash.h"
+
+
+/* PRIVATE FUNCTIONS */
+static void SPIFlash_SpiCpltCallback(spi_handler_t *spi);
+static hal_status_t SPIFlash_StartCmd(spi_flash_handler_t *handler, spi_flash_op_t op, uint8_t opcode, uint32_t Addr, uint8_t *pData, uint32_t Size);
+static void SPIFlash_NextChunk(spi_flash_handler_t *handler);
+static void SPIFlash_EndOp(spi_flash_handler_t *handler);
+static void SPIFlash_Abort(spi_flash_handler_t *handler);
+static void SPIFlash_Attach(spi_flash_handler_t *handler);
+static void SPIFlash_Detach(spi_flash_handler_t *handler);
+/* END OF PRIVATE FUNCTIONS */
+
+
+static uint8_t flash_wren_cmd = SPI_FLASH_CMD_WREN;
+
+
+static inline void SPIFlash_Select(spi_flash_handler_t *handler){
+	GPIO_ResetPin(handler->Init.CSGpio, handler->Init.CSPin);
+}
+
+static inline void SPIFlash_Deselect(spi_flash_handler_t *handler){
+	GPIO_SetPin(handler->Init.CSGpio, handler->Init.CSPin);
+}
+
+static void SPIFlash_Attach(spi_flash_handler_t *handler){
+	spi_handler_t *spi = handler->Spi;
+
+	if(spi->Owner == handler){
+		return;
+	}
+
+	// keep the callbacks of whoever used the SPI handler before
+	handler->SpiOwner = spi->Owner;
+	handler->SpiTxCpltCallback = spi->TxCpltCallback;
+	handler->SpiRxCpltCallback = spi->RxCpltCallback;
+	spi->Owner = handler;
+	spi->TxCpltCallback = SPIFlash_SpiCpltCallback;
+	spi->RxCpltCallback = SPIFlash_SpiCpltCallback;
+}
+
+static void SPIFlash_Detach(spi_flash_handler_t *handler){
+	spi_handler_t *spi = handler->Spi;
+
+	if(spi->Owner != handler){
+		return;
+	}
+
+	spi->Owner = handler->SpiOwner;
+	spi->TxCpltCallback = handler->SpiTxCpltCallback;
+	spi->RxCpltCallback = handler->SpiRxCpltCallback;
+}
+
+static void SPIFlash_SpiCpltCallback(spi_handler_t *spi){
+	spi_flash_handler_t *handler = (spi_flash_handler_t *)spi->Owner;
+
+	switch(handler->Phase){
+		case SPI_FLASH_PHASE_WREN:
+			// WREN must be latched by a rising edge of CS before the command
+			SPIFlash_Deselect(handler);
+			handler->Phase = SPI_FLASH_PHASE_CMD;
+			SPIFlash_Select(handler);
+			if(SPI_Transmit(spi, handler->Cmd, handler->CmdSize) != HAL_OK)
+				SPIFlash_Abort(handler);
+			break;
+
+		case SPI_FLASH_PHASE_CMD:
+			handler->Phase = SPI_FLASH_PHASE_DATA;
+			// fall through
+		case SPI_FLASH_PHASE_DATA:
+			if(handler->XferCount != 0){
+				SPIFlash_NextChunk(handler);
+			}
+			else {
+				SPIFlash_Deselect(handler);
+				SPIFlash_EndOp(handler);
+			}
+			break;
+	}
+}
+
+static void SPIFlash_NextChunk(spi_flash_handler_t *handler){
+	uint8_t chunk = (handler->XferCount > 0xFF) ? 0xFF : (uint8_t)handler->XferCount;
+	uint8_t *ptr = handler->XferPtr;
+
+	handler->XferPtr += chunk;
+	handler->XferCount -= chunk;
+
+	hal_status_t retCode;
+
+	if(handler->Op == SPI_FLASH_OP_PROGRAM)
+		retCode = SPI_Transmit(handler->Spi, ptr, chunk);
+	else
+		retCode = SPI_Receive(handler->Spi, ptr, chunk);
+
+	if(retCode != HAL_OK)
+		SPIFlash_Abort(handler);
+}
+
+static void SPIFlash_Abort(spi_flash_handler_t *handler){
+	spi_flash_op_t op = handler->Op;
+
+	// No completion will come for a refused frame, release CS and the command
+	SPIFlash_Deselect(handler);
+	SPIFlash_Detach(handler);
+	handler->Op = SPI_FLASH_OP_NONE;
+	handler->XferCount = 0;
+
+	if(op == SPI_FLASH_OP_STATUS){
+		handler->State = SPI_FLASH_STATE_BUSY_WRITE;	// retry on next poll
+		return;
+	}
+	if(op == SPI_FLASH_OP_PROGRAM || op == SPI_FLASH_OP_ERASE){
+		// A cut command may still start a cycle, poll until the device is idle
+		handler->WriteOp = SPI_FLASH_OP_NONE;
+		handler->State = SPI_FLASH_STATE_BUSY_WRITE;
+	}
+	else {
+		handler->State = SPI_FLASH_STATE_READY;
+	}
+
+	if(handler->ErrorCallback != NULL)
+		handler->ErrorCallback(handler);
+}
+
+static hal_status_t SPIFlash_StartCmd(spi_flash_handler_t *handler, spi_flash_op_t op, uint8_t opcode, uint32_t Addr, uint8_t *pData, uint32_t Size){
+	hal_status_t retCode;
+
+	if(SPI_GetState(handler->Spi) != SPI_STATE_READY){
+		return HAL_BUSY;	// SPI bus is taken by another device
+	}
+
+	handler->Cmd[0] = opcode;
+	handler->Cmd[1] = (uint8_t)(Addr >> 16);
+	handler->Cmd[2] = (uint8_t)(Addr >> 8);
+	handler->Cmd[3] = (uint8_t)(Addr);
+	handler->Cmd[4] = 0x00;	// Fast read dummy byte
+
+	switch(op){
+		case SPI_FLASH_OP_READ:
+			handler->CmdSize = 5;
+			handler->WriteEnable = 0;
+			break;
+		case SPI_FLASH_OP_PROGRAM:
+			handler->CmdSize = 4;
+			handler->WriteEnable = 1;
+			break;
+		case SPI_FLASH_OP_ERASE:
+			handler->CmdSize = (opcode == SPI_FLASH_CMD_CHIP_ERASE) ? 1 : 4;
+			handler->WriteEnable = 1;
+			break;
+		default:
+			handler->CmdSize = 1;
+			handler->WriteEnable = 0;
+			break;
+	}
+
+	handler->Op = op;
+	handler->XferPtr = pData;
+	handler->XferCount = Size;
+
+	SPIFlash_Attach(handler);
+	SPIFlash_Select(handler);
+	if(handler->WriteEnable){
+		handler->Phase = SPI_FLASH_PHASE_WREN;
+		retCode = SPI_Transmit(handler->Spi, &flash_wren_cmd, 1);
+	}
+	else {
+		handler->Phase = SPI_FLASH_PHASE_CMD;
+		retCode = SPI_Transmit(handler->Spi, handler->Cmd, handler->CmdSize);
+	}
+
+	if(retCode != HAL_OK){
+		// SPI bus is taken by another device
+		SPIFlash_Deselect(handler);
+		SPIFlash_Detach(handler);
+		handler->Op = SPI_FLASH_OP_NONE;
+	}
+
+	return retCode;
+}
+
+static void SPIFlash_EndOp(spi_flash_handler_t *handler){
+	spi_flash_op_t op = handler->Op;
+	handler->Op = SPI_FLASH_OP_NONE;
+	// bus is free again, a queued page program attaches back
+	SPIFlash_Detach(handler);
+
+	switch(op){
+		case SPI_FLASH_OP_READ:
+		case SPI_FLASH_OP_JEDEC_ID:
+			handler->State = SPI_FLASH_STATE_READY;
+			if(handler->ReadCpltCallback != NULL)
+				handler->ReadCpltCallback(handler);
+			break;
+
+		case SPI_FLASH_OP_PROGRAM:
+		case SPI_FLASH_OP_ERASE:
+			handler->WriteOp = op;
+			handler->State = SPI_FLASH_STATE_BUSY_WRITE;
+			break;
+
+		case SPI_FLASH_OP_STATUS:
+			if(handler->StatusReg & SPI_FLASH_SR_BUSY){
+				handler->State = SPI_FLASH_STATE_BUSY_WRITE;
+				break;
+			}
+
+			op = handler->WriteOp;
+			handler->WriteOp = SPI_FLASH_OP_NONE;
+			handler->State = SPI_FLASH_STATE_READY;
+
+			// Issue queued page before notifying, keeps the device busy
+			if(handler->PendValid){
+				handler->PendValid = 0;
+				handler->State = SPI_FLASH_STATE_BUSY;
+				if(SPIFlash_StartCmd(handler, SPI_FLASH_OP_PROGRAM, SPI_FLASH_CMD_PAGE_PROGRAM, handler->PendAddr, handler->PendPtr, handler->PendSize) != HAL_OK){
+					// Bus taken, keep it queued for next poll
+					handler->PendValid = 1;
+					handler->State = SPI_FLASH_STATE_BUSY_WRITE;
+				}
+			}
+
+			if(op == SPI_FLASH_OP_PROGRAM){
+				if(handler->ProgramCpltCallback != NULL)
+					handler->ProgramCpltCallback(handler);
+			}
+			else if(op == SPI_FLASH_OP_ERASE){
+				if(handler->EraseCpltCallback != NULL)
+					handler->EraseCpltCallback(handler);
+			}
+			break;
+
+		default:
+			handler->State = SPI_FLASH_STATE_READY;
+			break;
+	}
+}
+
+hal_status_t SPIFlash_Init(spi_flash_handler_t *handler){
+	if(handler == NULL || handler->Spi == NULL || handler->Init.CSGpio == NULL){
+		return HAL_ERROR;
+	}
+
+	__HAL_LOCK(handler);
+
+	SPIFlash_Deselect(handler);
+	GPIO_PinMode(handler->Init.CSGpio, handler->Init.CSPin, GPIO_MODE_OUTPUT);
+
+	handler->Op = SPI_FLASH_OP_NONE;
+	handler->WriteOp = SPI_FLASH_OP_NONE;
+	handler->PendValid = 0;
+	handler->XferCount = 0;
+	handler->State = SPI_FLASH_STATE_READY;
+
+	__HAL_UNLOCK(handler);
+	return HAL_OK;
+}
+
+void SPIFlash_DeInit(spi_flash_handler_t *handler){
+	SPIFlash_Deselect(handler);
+	GPIO_PinMode(handler->Init.CSGpio, handler->Init.CSPin, GPIO_MODE_INPUT_PULLUP);
+	SPIFlash_Detach(handler);
+	handler->PendValid = 0;
+	handler->State = SPI_FLASH_STATE_RESET;
+	__HAL_UNLOCK(handler);
+}
+
+spi_flash_state_t SPIFlash_GetState(spi_flash_handler_t *handler){
+	return handler->State;
+}
+
+hal_status_t SPIFlash_ReadJedecID(spi_flash_handler_t *handler, uint8_t *pId){
+	if(pId == NULL){
+		return HAL_ERROR;
+	}
+
+	hal_status_t retCode = HAL_BUSY;
+	__HAL_LOCK(handler);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->State == SPI_FLASH_STATE_READY){
+			handler->State = SPI_FLASH_STATE_BUSY;
+			retCode = SPIFlash_StartCmd(handler, SPI_FLASH_OP_JEDEC_ID, SPI_FLASH_CMD_JEDEC_ID, 0, pId, 3);
+			if(retCode != HAL_OK)
+				handler->State = SPI_FLASH_STATE_READY;
+		}
+	}
+
+	__HAL_UNLOCK(handler);
+	return retCode;
+}
+
+hal_status_t SPIFlash_Read(spi_flash_handler_t *handler, uint32_t Addr, uint8_t *pData, uint32_t Size){
+	if(pData == NULL || Size == 0){
+		return HAL_ERROR;
+	}
+
+	hal_status_t retCode = HAL_BUSY;
+	__HAL_LOCK(handler);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->State == SPI_FLASH_STATE_READY){
+			handler->State = SPI_FLASH_STATE_BUSY;
+			retCode = SPIFlash_StartCmd(handler, SPI_FLASH_OP_READ, SPI_FLASH_CMD_FAST_READ, Addr, pData, Size);
+			if(retCode != HAL_OK)
+				handler->State = SPI_FLASH_STATE_READY;
+		}
+	}
+
+	__HAL_UNLOCK(handler);
+	return retCode;
+}
+
+hal_status_t SPIFlash_PageProgram(spi_flash_handler_t *handler, uint32_t Addr, uint8_t *pData, uint16_t Size){
+	if(pData == NULL || Size == 0 || ((Addr & (SPI_FLASH_PAGE_SIZE - 1)) + Size) > SPI_FLASH_PAGE_SIZE){
+		return HAL_ERROR;
+	}
+
+	hal_status_t retCode = HAL_BUSY;
+	__HAL_LOCK(handler);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->State == SPI_FLASH_STATE_READY){
+			handler->State = SPI_FLASH_STATE_BUSY;
+			retCode = SPIFlash_StartCmd(handler, SPI_FLASH_OP_PROGRAM, SPI_FLASH_CMD_PAGE_PROGRAM, Addr, pData, Size);
+			if(retCode != HAL_OK)
+				handler->State = SPI_FLASH_STATE_READY;
+		}
+		else if(!handler->PendValid && (handler->Op == SPI_FLASH_OP_PROGRAM || handler->WriteOp == SPI_FLASH_OP_PROGRAM)){
+			// Pipeline: issue it once the running page program cycle is over
+			handler->PendAddr = Addr;
+			handler->PendPtr = pData;
+			handler->PendSize = Size;
+			handler->PendValid = 1;
+			retCode = HAL_OK;
+		}
+	}
+
+	__HAL_UNLOCK(handler);
+	return retCode;
+}
+
+static hal_status_t SPIFlash_Erase(spi_flash_handler_t *handler, uint8_t opcode, uint32_t Addr){
+	hal_status_t retCode = HAL_BUSY;
+	__HAL_LOCK(handler);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->State == SPI_FLASH_STATE_READY){
+			handler->State = SPI_FLASH_STATE_BUSY;
+			retCode = SPIFlash_StartCmd(handler, SPI_FLASH_OP_ERASE, opcode, Addr, NULL, 0);
+			if(retCode != HAL_OK)
+				handler->State = SPI_FLASH_STATE_READY;
+		}
+	}
+
+	__HAL_UNLOCK(handler);
+	return retCode;
+}
+
+hal_status_t SPIFlash_SectorErase(spi_flash_handler_t *handler, uint32_t Addr){
+	return SPIFlash_Erase(handler, SPI_FLASH_CMD_SECTOR_ERASE, Addr);
+}
+
+hal_status_t SPIFlash_BlockErase(spi_flash_handler_t *handler, uint32_t Addr){
+	return SPIFlash_Erase(handler, SPI_FLASH_CMD_BLOCK_ERASE, Addr);
+}
+
+hal_status_t SPIFlash_ChipErase(spi_flash_handler_t *handler){
+	return SPIFlash_Erase(handler, SPI_FLASH_CMD_CHIP_ERASE, 0);
+}
+
+void SPIFlash_PollHandler(spi_flash_handler_t *handler){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->State == SPI_FLASH_STATE_BUSY_WRITE){
+			handler->State = SPI_FLASH_STATE_POLLING;
+			if(SPIFlash_StartCmd(handler, SPI_FLASH_OP_STATUS, SPI_FLASH_CMD_RDSR, 0, &handler->StatusReg, 1) != HAL_OK)
+				handler->State = SPI_FLASH_STATE_BUSY_WRITE;	// Bus taken, retry on next poll
+		}
+	}
+}
+
+void SPIFlash_RegisterCallback(spi_flash_handler_t *handler, spi_flash_callback_id_t CallbackID, SPIFlash_Callback_t Callback){
+	switch (CallbackID) {
+		case SPI_FLASH_READ_COMPLETE_CB_ID:
+			handler->ReadCpltCallback = Callback;
+			break;
+
+		case SPI_FLASH_PROGRAM_COMPLETE_CB_ID:
+			handler->ProgramCpltCallback = Callback;
+			break;
+
+		case SPI_FLASH_ERASE_COMPLETE_CB_ID:
+			handler->EraseCpltCallback = Callback;
+			break;
+
+		case SPI_FLASH_ERROR_CB_ID:
+			handler->ErrorCallback = Callback;
+			break;
+
+		default:
+			break;
+	}
+}
+
+void SPIFlash_UnRegisterCallback(spi_flash_handler_t *handler, spi_flash_callback_id_t CallbackID){
+	switch (CallbackID) {
+		case SPI_FLASH_READ_COMPLETE_CB_ID:
+			handler->ReadCpltCallback = NULL;
+			break;
+
+		case SPI_FLASH_PROGRAM_COMPLETE_CB_ID:
+			handler->ProgramCpltCallback = NULL;
+			break;
+
+		case SPI_FLASH_ERASE_COMPLETE_CB_ID:
+			handler->EraseCpltCallback = NULL;
+			break;
+
+		case SPI_FLASH_ERROR_CB_ID:
+			handler->ErrorCallback = NULL;
+			break;
+
+		default:
+			break;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,268 @@
+/**
+ * @file hal_spi_flash.h
+ * @author Matheus Alencar Nascimento (matt-alencar)
+ * @brief Header file of SPI NOR Flash (W25Qxx / AT25xx family) driver.
+ **************************************************************************
+ * @copyright MIT License.
+ *
+ */
+
+#ifndef _SPI_FLASH_DRIVER_H_
+#define _SPI_FLASH_DRIVER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "hal_spi.h"
+
+
+#define SPI_FLASH_PAGE_SIZE			256UL
+#define SPI_FLASH_SECTOR_SIZE		4096UL
+#define SPI_FLASH_BLOCK_SIZE		65536UL
+
+#define SPI_FLASH_CMD_WREN			0x06
+#define SPI_FLASH_CMD_RDSR			0x05
+#define SPI_FLASH_CMD_FAST_READ		0x0B
+#define SPI_FLASH_CMD_PAGE_PROGRAM	0x02
+#define SPI_FLASH_CMD_SECTOR_ERASE	0x20
+#define SPI_FLASH_CMD_BLOCK_ERASE	0xD8
+#define SPI_FLASH_CMD_CHIP_ERASE	0xC7
+#define SPI_FLASH_CMD_JEDEC_ID		0x9F
+
+#define SPI_FLASH_SR_BUSY			_BV(0)	/*!< Write In Progress status bit */
+
+/**
+ * @brief SPI Flash state machine: driver states definition
+ */
+typedef enum {
+	SPI_FLASH_STATE_RESET,			/*!< Driver not yet initialized */
+	SPI_FLASH_STATE_READY,			/*!< Device idle and ready for a new command */
+	SPI_FLASH_STATE_BUSY,			/*!< A command is being clocked on the SPI bus */
+	SPI_FLASH_STATE_BUSY_WRITE,		/*!< Device is running an internal program/erase cycle */
+	SPI_FLASH_STATE_POLLING			/*!< Status register read ongoing while device is busy */
+}spi_flash_state_t;
+
+/**
+ * @brief SPI Flash operations
+ */
+typedef enum {
+	SPI_FLASH_OP_NONE,
+	SPI_FLASH_OP_READ,
+	SPI_FLASH_OP_PROGRAM,
+	SPI_FLASH_OP_ERASE,
+	SPI_FLASH_OP_STATUS,
+	SPI_FLASH_OP_JEDEC_ID
+}spi_flash_op_t;
+
+/**
+ * @brief SPI Flash command sequencer phases
+ */
+typedef enum {
+	SPI_FLASH_PHASE_WREN,			/*!< Write enable frame */
+	SPI_FLASH_PHASE_CMD,			/*!< Opcode, address and dummy bytes */
+	SPI_FLASH_PHASE_DATA			/*!< Data payload */
+}spi_flash_phase_t;
+
+/**
+ * @brief SPI Flash Callback IDs
+ */
+typedef enum {
+	SPI_FLASH_READ_COMPLETE_CB_ID,
+	SPI_FLASH_PROGRAM_COMPLETE_CB_ID,
+	SPI_FLASH_ERASE_COMPLETE_CB_ID,
+	SPI_FLASH_ERROR_CB_ID
+}spi_flash_callback_id_t;
+
+/**
+ * @brief Structure definition of SPI Flash initialization
+ */
+typedef struct {
+	gpio_t *CSGpio;					/*!< Chip select GPIO port */
+	gpio_pin_t CSPin;				/*!< Chip select GPIO pin */
+}spi_flash_init_t;
+
+/**
+ * @brief SPI Flash handle Structure definition
+ */
+typedef struct _spi_flash_handler {
+	spi_handler_t *Spi;										/*!< SPI bus handler, must be initialized as master */
+	spi_flash_init_t Init;									/*!< SPI Flash required parameters */
+	hal_lock_t Lock;										/*!< SPI Flash locking object */
+	volatile spi_flash_state_t State;						/*!< SPI Flash State */
+
+	volatile spi_flash_op_t Op;								/*!< Operation being clocked on the bus */
+	volatile spi_flash_op_t WriteOp;						/*!< Program/erase cycle running inside the device */
+	volatile spi_flash_phase_t Phase;						/*!< Command sequencer phase */
+	uint8_t WriteEnable;									/*!< Send WREN frame before the command */
+	uint8_t Cmd[5];											/*!< Opcode + 24-bit address + dummy byte */
+	uint8_t CmdSize;										/*!< Command header size */
+	uint8_t StatusReg;										/*!< Last status register value */
+
+	uint8_t *XferPtr;										/*!< Data phase buffer pointer */
+	volatile uint32_t XferCount;							/*!< Data phase remaining bytes */
+
+	uint32_t PendAddr;										/*!< Queued page program address */
+	uint8_t *PendPtr;										/*!< Queued page program buffer */
+	uint16_t PendSize;										/*!< Queued page program size */
+	volatile uint8_t PendValid;								/*!< Queued page program flag */
+
+	void *SpiOwner;											/*!< SPI handler owner saved while a command runs */
+	SPI_Callback_t SpiTxCpltCallback;						/*!< SPI handler TX complete callback saved while a command runs */
+	SPI_Callback_t SpiRxCpltCallback;						/*!< SPI handler RX complete callback saved while a command runs */
+
+	void (*ReadCpltCallback)(struct _spi_flash_handler *handler);		/*!< Read / JEDEC ID complete callback */
+	void (*ProgramCpltCallback)(struct _spi_flash_handler *handler);	/*!< Page program cycle complete callback */
+	void (*EraseCpltCallback)(struct _spi_flash_handler *handler);		/*!< Erase cycle complete callback */
+	void (*ErrorCallback)(struct _spi_flash_handler *handler);			/*!< SPI bus refused a frame, command aborted */
+}spi_flash_handler_t;
+
+
+/**
+ * @brief SPI Flash Callback TypeDef
+ */
+typedef void (*SPIFlash_Callback_t)(spi_flash_handler_t *handler);
+
+
+/**
+ * @brief Initializes the SPI Flash driver and its chip select pin
+ * @note The SPI handler must be already initialized as master. While a flash
+ *       command is running the driver owns the SPI handler completion callbacks,
+ *       the previous ones are restored when it is over. Several flash devices
+ *       and other drivers can share the same SPI handler.
+ *
+ * @param handler SPI Flash Handler Pointer
+ * @return HAL Status
+ */
+hal_status_t SPIFlash_Init(spi_flash_handler_t *handler);
+
+
+/**
+ * @brief Deinitialize the SPI Flash driver and release chip select pin
+ *
+ * @param handler SPI Flash Handler Pointer
+ */
+void SPIFlash_DeInit(spi_flash_handler_t *handler);
+
+
+/**
+ * @brief Return the SPI Flash driver state
+ *
+ * @param handler SPI Flash Handler Pointer
+ * @return SPI Flash State
+ */
+spi_flash_state_t SPIFlash_GetState(spi_flash_handler_t *handler);
+
+
+/**
+ * @brief Read the 3 bytes JEDEC ID (manufacturer, memory type, capacity)
+ * @note ReadCpltCallback is called when done
+ *
+ * @param handler SPI Flash Handler Pointer
+ * @param[out] pId Pointer to a 3 bytes buffer
+ * @return HAL Status
+ */
+hal_status_t SPIFlash_ReadJedecID(spi_flash_handler_t *handler, uint8_t *pId);
+
+
+/**
+ * @brief Stream a fast read of any length starting on address
+ * @note Data is clocked in chunks of up to 255 bytes chained from the SPI
+ *       completion IRQ, chip select stays low for the whole read.
+ *       ReadCpltCallback is called when done.
+ *
+ * @param handler SPI Flash Handler Pointer
+ * @param Addr 24-bit start address
+ * @param[out] pData Destination buffer
+ * @param Size Number of bytes to read
+ * @return HAL Status
+ */
+hal_status_t SPIFlash_Read(spi_flash_handler_t *handler, uint32_t Addr, uint8_t *pData, uint32_t Size);
+
+
+/**
+ * @brief Program up to one page (256 bytes)
+ * @note If a page program is already running, this one is queued and issued
+ *       as soon as the device reports the previous cycle is over, so the
+ *       application can refill its next buffer during the busy time.
+ *       Only one page can be queued. ProgramCpltCallback is called for each
+ *       page when its internal program cycle is over, at this point the
+ *       page buffer can be reused.
+ *
+ * @param handler SPI Flash Handler Pointer
+ * @param Addr 24-bit start address
+ * @param pData Source buffer, must remain valid until ProgramCpltCallback
+ * @param Size Number of bytes, the write must not cross a page boundary
+ * @return HAL Status: HAL_BUSY if device is busy and queue is full
+ */
+hal_status_t SPIFlash_PageProgram(spi_flash_handler_t *handler, uint32_t Addr, uint8_t *pData, uint16_t Size);
+
+
+/**
+ * @brief Erase the 4KB sector containing address
+ * @note EraseCpltCallback is called when the erase cycle is over
+ *
+ * @param handler SPI Flash Handler Pointer
+ * @param Addr 24-bit address inside the sector
+ * @return HAL Status
+ */
+hal_status_t SPIFlash_SectorErase(spi_flash_handler_t *handler, uint32_t Addr);
+
+
+/**
+ * @brief Erase the 64KB block containing address
+ * @note EraseCpltCallback is called when the erase cycle is over
+ *
+ * @param handler SPI Flash Handler Pointer
+ * @param Addr 24-bit address inside the block
+ * @return HAL Status
+ */
+hal_status_t SPIFlash_BlockErase(spi_flash_handler_t *handler, uint32_t Addr);
+
+
+/**
+ * @brief Erase whole memory array
+ * @note EraseCpltCallback is called when the erase cycle is over
+ *
+ * @param handler SPI Flash Handler Pointer
+ * @return HAL Status
+ */
+hal_status_t SPIFlash_ChipErase(spi_flash_handler_t *handler);
+
+
+/**
+ * @brief Status polling handler
+ * @note Should be called periodically (timer IRQ or main loop). While the
+ *       device is busy on a program/erase cycle, it starts a non-blocking
+ *       status register read. Once the device is idle the completion
+ *       callback is called and a queued page program is issued.
+ *
+ * @param handler SPI Flash Handler Pointer
+ */
+void SPIFlash_PollHandler(spi_flash_handler_t *handler);
+
+
+/**
+ * @brief Register user callback
+ *
+ * @param handler SPI Flash Handler Pointer
+ * @param CallbackID Callback ID
+ * @param Callback Pointer to the Callback function
+ */
+void SPIFlash_RegisterCallback(spi_flash_handler_t *handler, spi_flash_callback_id_t CallbackID, SPIFlash_Callback_t Callback);
+
+
+/**
+ * @brief Unregister user callback
+ *
+ * @param handler SPI Flash Handler Pointer
+ * @param CallbackID Callback ID
+ */
+void SPIFlash_UnRegisterCallback(spi_flash_handler_t *handler, spi_flash_callback_id_t CallbackID);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SPI_FLASH_DRIVER_H_ */
\ No newline at end of file
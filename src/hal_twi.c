@@ -6,14 +6,31 @@
 /* PRIVATE FUNCTIONS */
 static void TWI_Reply(twi_handler_t *handler, uint8_t ack);
 static void TWI_Stop(twi_handler_t *handler);
+static void TWI_StopDone(twi_handler_t *handler);
+static void TWI_StopWait(twi_handler_t *handler);
 static void TWI_ReleaseBus(twi_handler_t *handler);
+static void TWI_SlaveCplt(twi_handler_t *handler, void (*Callback)(struct _twi_handler *handler));
+static void TWI_SlaveNotify(twi_handler_t *handler, void (*Callback)(struct _twi_handler *handler));
 static void TWI_StartTxn(twi_handler_t *handler);
-static uint8_t TWI_GetTWBR(twi_clock_t clock);
+static void TWI_MasterSetup(twi_handler_t *handler, uint8_t DeviceAddr, const uint8_t *pHeader, uint8_t HeaderSize, uint8_t *pTxData, uint16_t TxSize, uint8_t *pRxData, uint16_t RxSize, uint8_t SendStop);
+static void TWI_MasterCplt(twi_handler_t *handler);
+static void TWI_MasterNotify(twi_handler_t *handler, uint8_t err, uint8_t read);
+static void TWI_TxnLoad(twi_handler_t *handler);
+static void TWI_MasterRewind(twi_handler_t *handler);
+static void TWI_BusRecover(twi_handler_t *handler);
+static void TWI_ScanNext(twi_handler_t *handler, uint8_t present);
+static void TWI_ScanDone(twi_handler_t *handler);
+static void TWI_ArbSuspend(twi_handler_t *handler);
+static void TWI_ArbResume(twi_handler_t *handler);
+static void TWI_SetBitRate(twi_handler_t *handler, uint32_t Freq);
 static void TWI_SetupGPIO(twi_handler_t *handler);
 /* END OF PRIVATE FUNCTIONS */
 
 
 void TWI_IRQHandler(twi_handler_t *handler){
+	// a previously issued stop is over once a new bus event shows up
+	TWI_StopDone(handler);
+
 	uint8_t twi_status = handler->Instance->TWSR_REG & TW_STATUS_MASK;
 	switch(twi_status){
 		/* All Master */
@@ -27,59 +44,63 @@ void TWI_IRQHandler(twi_handler_t *handler){
 		/* Master Transmitter */
 		case TW_MT_SLA_ACK:				// slave receiver acked address
 		case TW_MT_DATA_ACK:			// slave receiver acked data
-			// if there is data to send, send it, otherwise stop
-			if(handler->TxRxBuffIndex < handler->TxRxBuffSize){
+			if(handler->State == TWI_STATE_SCAN){
+				TWI_ScanNext(handler, 1);
+				break;
+			}
+
+			// send header bytes (memory address) first, then payload
+			if(handler->HeaderIndex < handler->HeaderSize){
+				handler->Instance->TWDR_REG = handler->Header[handler->HeaderIndex++];
+				TWI_Reply(handler, 1);
+			}
+			else if(handler->TxBuffIndex < handler->TxBuffSize){
 				// copy data to output register and ack
-				TWI0->TWDR_REG = handler->TxRxBuffPtr[handler->TxRxBuffIndex++];
+				handler->Instance->TWDR_REG = handler->TxBuffPtr[handler->TxBuffIndex++];
 				TWI_Reply(handler, 1);
 			}
+			else if(handler->RxBuffSize != 0){
+				// write phase is over, turn the bus around with a repeated start
+				handler->Slarw |= TW_READ;
+				handler->State = TWI_STATE_MRX;
+				handler->Instance->TWCR_REG = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+			}
 			else{
-				if(handler->SendStop)
-					TWI_Stop(handler);
-				else {
-					handler->Instance->TWCR_REG = (_BV(TWINT) | _BV(TWSTA)| _BV(TWEN));
-					handler->InRepStart = 1;
-					handler->State = TWI_STATE_READY;
-				}
-				if(handler->MasterTxCpltCallback != NULL)
-					handler->MasterTxCpltCallback(handler);
+				TWI_MasterCplt(handler);
 			}
 			break;
 		case TW_MT_SLA_NACK:			// address sent, nack received
-			handler->ErrCode = TW_MT_SLA_NACK;
-			TWI_Stop(handler);
-
-			if(handler->ErrorCallback != NULL){
-				handler->ErrorCallback(handler);
-			}
-			
-			break;
 		case TW_MT_DATA_NACK:			// data sent, nack received
-			handler->ErrCode = TW_MT_DATA_NACK;
-			TWI_Stop(handler);
-
-			if(handler->ErrorCallback != NULL){
-				handler->ErrorCallback(handler);
+		case TW_MT_ARB_LOST:			// lost bus arbitration
+			if(handler->State == TWI_STATE_SCAN){
+				if(twi_status == TW_MT_ARB_LOST){
+					handler->ErrCode = twi_status;
+					TWI_ScanDone(handler);
+				}
+				else {
+					TWI_ScanNext(handler, 0);
+				}
+				break;
 			}
 
-			break;
-		case TW_MT_ARB_LOST:			// lost bus arbitration
-			handler->ErrCode = TW_MT_ARB_LOST;
-			TWI_ReleaseBus(handler);
-			
-			if(handler->ErrorCallback != NULL){
-				handler->ErrorCallback(handler);
+			if(twi_status == TW_MT_ARB_LOST && handler->Init.MultiMaster){
+				TWI_ArbSuspend(handler);
+				TWI_ArbResume(handler);
+				break;
 			}
 
+			handler->ErrCode = twi_status;
+			TWI_MasterCplt(handler);
 			break;
 
 		/* Master Receiver */
 		case TW_MR_DATA_ACK:			// data received, ack sent
 			// put byte into buffer
-			handler->TxRxBuffPtr[handler->TxRxBuffIndex++] = TWI0->TWDR_REG;
+			handler->RxBuffPtr[handler->RxBuffIndex++] = handler->Instance->TWDR_REG;
 		case TW_MR_SLA_ACK:				// address sent, ack received
-			// ack if more bytes are expected, otherwise nack
-			if(handler->TxRxBuffIndex < handler->TxRxBuffSize){
+			// On receive, the configured ACK/NACK is transmitted in response to the
+			// _next_ byte, so NACK must be armed when the next to last byte arrives
+			if((handler->RxBuffIndex + 1) < handler->RxBuffSize){
 				TWI_Reply(handler, 1);
 			}else{
 				TWI_Reply(handler, 0);
@@ -87,25 +108,12 @@ void TWI_IRQHandler(twi_handler_t *handler){
 			break;
 		case TW_MR_DATA_NACK:			// data received, nack sent
 			// put final byte into buffer
-			handler->TxRxBuffPtr[handler->TxRxBuffIndex++] = TWI0->TWDR_REG;
-			
-			handler->TxRxBuffSize = handler->TxRxBuffIndex;
-			handler->TxRxBuffIndex = 0;
-
-			if(handler->SendStop)
-				TWI_Stop(handler);
-			else {
-				handler->Instance->TWCR_REG = (_BV(TWINT) | _BV(TWSTA)| _BV(TWEN));
-				handler->InRepStart = 1;
-				handler->State = TWI_STATE_READY;
-			}
+			handler->RxBuffPtr[handler->RxBuffIndex++] = handler->Instance->TWDR_REG;
+			TWI_MasterCplt(handler);
 			break;
 		case TW_MR_SLA_NACK:			// address sent, nack received
 			handler->ErrCode = TW_MR_SLA_NACK;
-			TWI_Stop(handler);
-			if(handler->ErrorCallback != NULL){
-				handler->ErrorCallback(handler);
-			}
+			TWI_MasterCplt(handler);
 			break;
 		// TW_MR_ARB_LOST handled by TW_MT_ARB_LOST case
 
@@ -114,8 +122,23 @@ void TWI_IRQHandler(twi_handler_t *handler){
 		case TW_SR_GCALL_ACK:			// addressed generally, returned ack
 		case TW_SR_ARB_LOST_SLA_ACK:	// lost arbitration, returned ack
 		case TW_SR_ARB_LOST_GCALL_ACK:	// lost arbitration, returned ack
+			if(twi_status == TW_SR_ARB_LOST_SLA_ACK || twi_status == TW_SR_ARB_LOST_GCALL_ACK){
+				// our master transaction resumes once the slave transfer is over
+				TWI_ArbSuspend(handler);
+			}
+
 			// enter slave receiver mode
 			handler->State = TWI_STATE_SRX;
+			handler->ErrCode = TW_NO_INFO;
+			handler->XferCount = 0;
+
+			if(handler->RegMap != NULL){
+				// first bytes of every write set the register pointer
+				handler->RegPtrIndex = 0;
+				TWI_Reply(handler, 1);
+				break;
+			}
+
 			handler->TxRxBuffIndex = 0;
 			handler->TxRxBuffSize = 0;
 			handler->TxRxBuffPtr = NULL;
@@ -133,8 +156,29 @@ void TWI_IRQHandler(twi_handler_t *handler){
 		case TW_SR_DATA_ACK:			// data received, returned ack
 		case TW_SR_GCALL_DATA_ACK:		// data received generally, returned ack
 
+			if(handler->RegMap != NULL){
+				uint8_t data = handler->Instance->TWDR_REG;
+				if(handler->RegPtrIndex < handler->RegPtrSize){
+					handler->RegPtr = (handler->RegPtrIndex == 0) ? data : ((handler->RegPtr << 8) | data);
+					if(++handler->RegPtrIndex == handler->RegPtrSize && handler->RegPtr >= handler->RegMapSize){
+						handler->RegPtr %= handler->RegMapSize;
+					}
+				}
+				else {
+					uint16_t reg = handler->RegPtr;
+					if(handler->RegMapWP == NULL || !(handler->RegMapWP[reg >> 3] & _BV(reg & 0x07))){
+						handler->RegMap[reg] = data;
+					}
+					handler->XferCount++;
+					handler->RegPtr = (reg + 1 < handler->RegMapSize) ? (reg + 1) : 0;
+				}
+				TWI_Reply(handler, 1);
+				break;
+			}
+
 			if(handler->TxRxBuffIndex < handler->TxRxBuffSize){
 				handler->TxRxBuffPtr[handler->TxRxBuffIndex++] = handler->Instance->TWDR_REG;
+				handler->XferCount++;
 			}
 
 			if(handler->TxRxBuffIndex < handler->TxRxBuffSize){
@@ -151,32 +195,52 @@ void TWI_IRQHandler(twi_handler_t *handler){
 		case TW_SR_GCALL_DATA_NACK:		// data received generally, returned nack
 			// The master must stop communication if any of these condition happen
 			// ack future responses and leave slave receiver state
-			TWI_ReleaseBus(handler);
-			if(handler->SlaveRxCpltCallback != NULL){
-				handler->SlaveRxCpltCallback(handler);
+			if(twi_status != TW_SR_STOP){
+				// master kept writing past the receive buffer, extra byte dropped
+				handler->ErrCode = twi_status;
 			}
+			TWI_SlaveCplt(handler, handler->SlaveRxCpltCallback);
 
 			break;
 
 		/* Slave Transmitter */
 		case TW_ST_SLA_ACK:				// addressed, returned ack
+		case TW_ST_ARB_LOST_SLA_ACK:	// arbitration lost, returned ack
+			if(twi_status == TW_ST_ARB_LOST_SLA_ACK){
+				// our master transaction resumes once the slave transfer is over
+				TWI_ArbSuspend(handler);
+			}
+
 			handler->State = TWI_STATE_STX;
+			handler->ErrCode = TW_NO_INFO;
+			handler->XferCount = 0;
 			handler->TxRxBuffIndex = 0;
 			handler->TxRxBuffSize = 0;
 			handler->TxRxBuffPtr = NULL;
 
-			if(handler->AddrCallback != NULL){
+			if(handler->AddrCallback != NULL && handler->RegMap == NULL){
 				handler->AddrCallback(handler, TW_READ);
 			}
 
-		case TW_ST_ARB_LOST_SLA_ACK:	// arbitration lost, returned ack
 		case TW_ST_DATA_ACK:			// byte sent, ack returned
 			// enter slave transmitter mode
 
-			if(handler->TxRxBuffIndex < handler->TxRxBuffSize)
-				TWI0->TWDR_REG = handler->TxRxBuffPtr[handler->TxRxBuffIndex++];
+			if(handler->RegMap != NULL){
+				// reads continue from the register pointer, there is always a next byte
+				handler->State = TWI_STATE_STX;
+				handler->Instance->TWDR_REG = handler->RegMap[handler->RegPtr];
+				handler->RegPtr = (handler->RegPtr + 1 < handler->RegMapSize) ? (handler->RegPtr + 1) : 0;
+				handler->XferCount++;
+				TWI_Reply(handler, 1);
+				break;
+			}
+
+			if(handler->TxRxBuffIndex < handler->TxRxBuffSize){
+				handler->Instance->TWDR_REG = handler->TxRxBuffPtr[handler->TxRxBuffIndex++];
+				handler->XferCount++;
+			}
 			else
-				TWI0->TWDR_REG = 0xFF; // Send dummy byte
+				handler->Instance->TWDR_REG = 0xFF; // Send dummy byte
 
 			// Send response for future transactions
 			if(handler->TxRxBuffIndex < handler->TxRxBuffSize)
@@ -190,11 +254,11 @@ void TWI_IRQHandler(twi_handler_t *handler){
 		case TW_ST_LAST_DATA:			// received ack, but we are done already!
 			// The master must stop communication if any of these condition happen
 			// ack future responses and leave slave receiver state
-			TWI_ReleaseBus(handler);
-
-			if(handler->SlaveTxCpltCallback != NULL){
-				handler->SlaveTxCpltCallback(handler);
+			if(twi_status == TW_ST_LAST_DATA || (handler->RegMap == NULL && handler->TxRxBuffIndex < handler->TxRxBuffSize)){
+				// master wanted more data, or stopped reading before the end of buffer
+				handler->ErrCode = twi_status;
 			}
+			TWI_SlaveCplt(handler, handler->SlaveTxCpltCallback);
 
 			break;
 
@@ -203,6 +267,14 @@ void TWI_IRQHandler(twi_handler_t *handler){
 			break;
 		case TW_BUS_ERROR: // bus error, illegal stop/start
 			handler->ErrCode = TW_BUS_ERROR;
+			if(handler->State == TWI_STATE_MTX || handler->State == TWI_STATE_MRX){
+				TWI_MasterCplt(handler);
+				break;
+			}
+			if(handler->State == TWI_STATE_SCAN){
+				TWI_ScanDone(handler);
+				break;
+			}
 			TWI_Stop(handler);
 
 			if(handler->ErrorCallback != NULL){
@@ -221,10 +293,37 @@ static void TWI_SetupGPIO(twi_handler_t *handler){
 	}
 }
 
-static uint8_t TWI_GetTWBR(twi_clock_t clock){
-	const uint32_t TWI_FREQ[] = {50000UL, 100000UL, 400000UL};
-	uint8_t value = ((F_CPU / TWI_FREQ[clock]) - 16) / 2;
-	return value;
+static void TWI_SetBitRate(twi_handler_t *handler, uint32_t Freq){
+	// SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS)
+	uint32_t div = (F_CPU + (Freq / 2)) / Freq;
+	uint32_t bestFreq = 0;
+	uint8_t bestTwbr = 0;
+	uint8_t bestPs = 0;
+
+	div = (div > 16) ? (div - 16) : 0;
+
+	for(uint8_t ps = 0; ps < 4; ps++){
+		uint32_t step = 2UL << (2 * ps);
+		uint32_t twbr = (div + (step / 2)) / step;
+		if(twbr > 255){
+			twbr = 255;
+		}
+
+		uint32_t actual = F_CPU / (16 + (twbr * step));
+		uint32_t err = (actual > Freq) ? (actual - Freq) : (Freq - actual);
+		uint32_t bestErr = (bestFreq > Freq) ? (bestFreq - Freq) : (Freq - bestFreq);
+
+		// lowest prescaler wins a tie, it gives the finest TWBR resolution
+		if(bestFreq == 0 || err < bestErr){
+			bestFreq = actual;
+			bestTwbr = (uint8_t)twbr;
+			bestPs = ps;
+		}
+	}
+
+	MODIFY_REG(handler->Instance->TWSR_REG, _BV(TWPS0) | _BV(TWPS1), bestPs);
+	handler->Instance->TWBR_REG = bestTwbr;
+	handler->ClockFreq = bestFreq;
 }
 
 static void TWI_Reply(twi_handler_t *handler, uint8_t ack){
@@ -240,25 +339,286 @@ static void TWI_Stop(twi_handler_t *handler){
 	// send stop condition
 	handler->Instance->TWCR_REG = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO);
 
-	// wait for stop condition to be exectued on bus
-	// TWINT is not set after a stop condition!
-	while(handler->Instance->TWCR_REG & _BV(TWSTO)){
-		continue;
+	// TWINT is not set after a stop condition, so do not wait for it here:
+	// TWSTO clears by hardware once the stop is on the bus, see TWI_StopDone
+	handler->State = TWI_STATE_STOP;
+}
+
+static void TWI_BusRecover(twi_handler_t *handler){
+	// take the lines from the TWI module, they are driven open drain:
+	// output low pulls the line, input releases it to the external pull-up
+	handler->Instance->TWCR_REG = 0;
+
+	if(handler->Instance == TWI0){
+		GPIO_PinMode(TWI0_SCL_GPIO, TWI0_SCL_PIN, GPIO_MODE_INPUT);
+		GPIO_PinMode(TWI0_SDA_GPIO, TWI0_SDA_PIN, GPIO_MODE_INPUT);
+		GPIO_ResetPin(TWI0_SCL_GPIO, TWI0_SCL_PIN);
+		GPIO_ResetPin(TWI0_SDA_GPIO, TWI0_SDA_PIN);
+
+		// clock SCL until the slave releases SDA, 9 clocks flush a byte and its ack
+		for(uint8_t i = 0; i < 9 && GPIO_ReadPin(TWI0_SDA_GPIO, TWI0_SDA_PIN) == GPIO_STATE_LOW; i++){
+			GPIO_PinMode(TWI0_SCL_GPIO, TWI0_SCL_PIN, GPIO_MODE_OUTPUT);
+			_delay_us(TWI_RECOVERY_HALF_PERIOD_US);
+			GPIO_PinMode(TWI0_SCL_GPIO, TWI0_SCL_PIN, GPIO_MODE_INPUT);
+			_delay_us(TWI_RECOVERY_HALF_PERIOD_US);
+		}
+
+		// manual stop: SDA rising while SCL is high
+		GPIO_PinMode(TWI0_SCL_GPIO, TWI0_SCL_PIN, GPIO_MODE_OUTPUT);
+		GPIO_PinMode(TWI0_SDA_GPIO, TWI0_SDA_PIN, GPIO_MODE_OUTPUT);
+		_delay_us(TWI_RECOVERY_HALF_PERIOD_US);
+		GPIO_PinMode(TWI0_SCL_GPIO, TWI0_SCL_PIN, GPIO_MODE_INPUT);
+		_delay_us(TWI_RECOVERY_HALF_PERIOD_US);
+		GPIO_PinMode(TWI0_SDA_GPIO, TWI0_SDA_PIN, GPIO_MODE_INPUT);
+		_delay_us(TWI_RECOVERY_HALF_PERIOD_US);
 	}
 
-	handler->State = TWI_STATE_READY;
+	// re-init, address and bit rate registers are left untouched
+	TWI_SetupGPIO(handler);
+	handler->Instance->TWCR_REG = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
+}
+
+static void TWI_StopDone(twi_handler_t *handler){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->State == TWI_STATE_STOP && !(handler->Instance->TWCR_REG & _BV(TWSTO))){
+			handler->State = TWI_STATE_READY;
+			// start transactions queued while the stop was on the bus, unless a
+			// bus event is pending (TWINT): its release path starts them then
+			if(handler->TxnHead != NULL && !(handler->Instance->TWCR_REG & _BV(TWINT))){
+				TWI_TxnLoad(handler);
+				TWI_StartTxn(handler);
+			}
+		}
+	}
+}
+
+static void TWI_StopWait(twi_handler_t *handler){
+	if(handler->ClockFreq == 0){
+		return;
+	}
+
+	// a stop raises no interrupt, nothing would start the queue if main sleeps:
+	// it is off the bus within a few SCL periods unless a slave holds SCL low
+	uint16_t us = (uint16_t)((TWI_STOP_WAIT_PERIODS * 1000000UL) / handler->ClockFreq) + 1;
+	while(handler->State == TWI_STATE_STOP && us--){
+		_delay_us(1);
+		TWI_StopDone(handler);
+	}
 }
 
 static void TWI_ReleaseBus(twi_handler_t *handler){
+	if(handler->ArbSuspended){
+		// master transaction lost arbitration before, retry it first
+		TWI_ArbResume(handler);
+		return;
+	}
+
+	if(handler->TxnHead != NULL){
+		// release bus and start the next queued transaction once it is free
+		TWI_TxnLoad(handler);
+		handler->Instance->TWCR_REG = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+		return;
+	}
+
 	// release bus
 	handler->Instance->TWCR_REG = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT);
 	// update twi state
 	handler->State = TWI_STATE_READY;
 }
 
+static void TWI_SlaveCplt(twi_handler_t *handler, void (*Callback)(struct _twi_handler *handler)){
+	if(handler->TxnHead != NULL || handler->ArbSuspended){
+		// report first, the master transaction started on release resets ErrCode
+		TWI_SlaveNotify(handler, Callback);
+		TWI_ReleaseBus(handler);
+	}
+	else {
+		TWI_ReleaseBus(handler);
+		TWI_SlaveNotify(handler, Callback);
+	}
+}
+
+static void TWI_SlaveNotify(twi_handler_t *handler, void (*Callback)(struct _twi_handler *handler)){
+	// slave errors (overflow, early nack, TWI_ERR_LAST_DATA) complete the transfer too
+	if(Callback != NULL)
+		Callback(handler);
+	if(handler->ErrCode != TW_NO_INFO && handler->ErrorCallback != NULL)
+		handler->ErrorCallback(handler);
+}
+
+static void TWI_MasterCplt(twi_handler_t *handler){
+	twi_txn_t *txn = handler->TxnActive;
+	uint8_t err = handler->ErrCode;
+	uint8_t read = handler->Slarw & TW_READ;
+	uint8_t hold = (handler->SendStop == 0 && err == TW_NO_INFO);
+	uint8_t notify = (txn == NULL);
+
+	if(read){
+		handler->XferCount = handler->RxBuffIndex;
+	}
+	else {
+		// bytes acknowledged by the slave
+		handler->XferCount = handler->HeaderIndex + handler->TxBuffIndex;
+		if(err == TW_MT_DATA_NACK){
+			handler->XferCount--;
+		}
+	}
+
+	if(txn != NULL){
+		// Queued transaction callback runs before the bus is released (TWINT
+		// still set, SCL stretched) so a transaction queued from it is chained
+		handler->TxnActive = NULL;
+		txn->ErrCode = err;
+		txn->XferCount = handler->XferCount;
+		txn->Status = (err == TW_NO_INFO) ? TWI_TXN_DONE : TWI_TXN_ERROR;
+		if(txn->Callback != NULL){
+			txn->Callback(handler, txn);
+		}
+	}
+
+	if(err == TW_MT_ARB_LOST){
+		// another master owns the bus
+		TWI_ReleaseBus(handler);
+	}
+	else if(handler->TxnHead != NULL && !(hold && notify)){
+		if(notify){
+			// report the direct transfer first, loading the next one resets ErrCode
+			TWI_MasterNotify(handler, err, read);
+			notify = 0;
+		}
+		TWI_TxnLoad(handler);
+		if(hold){
+			// repeated start, the bus is never released between transactions
+			handler->Instance->TWCR_REG = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+		}
+		else {
+			// stop followed by start in a single write
+			handler->Instance->TWCR_REG = _BV(TWINT) | _BV(TWSTO) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+		}
+	}
+	else if(hold){
+		handler->Instance->TWCR_REG = (_BV(TWINT) | _BV(TWSTA)| _BV(TWEN));
+		// a direct caller continues with its own follow-up, the queue waits for it
+		handler->InRepStart = 1;
+		handler->InRepStartDirect = notify;
+		handler->State = TWI_STATE_READY;
+	}
+	else {
+		TWI_Stop(handler);
+	}
+
+	if(notify){
+		TWI_MasterNotify(handler, err, read);
+	}
+}
+
+static void TWI_MasterNotify(twi_handler_t *handler, uint8_t err, uint8_t read){
+	if(err != TW_NO_INFO){
+		if(handler->ErrorCallback != NULL)
+			handler->ErrorCallback(handler);
+	}
+	else if(read){
+		if(handler->MasterRxCpltCallback != NULL)
+			handler->MasterRxCpltCallback(handler);
+	}
+	else {
+		if(handler->MasterTxCpltCallback != NULL)
+			handler->MasterTxCpltCallback(handler);
+	}
+}
+
+static void TWI_ArbSuspend(twi_handler_t *handler){
+	if(!handler->Init.MultiMaster || (handler->State != TWI_STATE_MTX && handler->State != TWI_STATE_MRX)){
+		return;
+	}
+
+	// keep the master transaction, it is restarted by TWI_ArbResume
+	handler->ArbSuspended = 1;
+	handler->ArbCount++;
+	if(handler->Init.ArbBackoff != 0){
+		// bounded random backoff, so competing masters do not collide again
+		hal_tick_t now = Tick_Get();
+		handler->ArbSeed = (uint8_t)((handler->ArbSeed * 109U) + 89U + (uint8_t)now);
+		handler->BackoffTick = now + (handler->ArbSeed % (handler->Init.ArbBackoff + 1U));
+	}
+}
+
+static void TWI_ArbResume(twi_handler_t *handler){
+	if(handler->ArbCount > handler->Init.ArbRetries){
+		// give up, report arbitration lost
+		handler->ArbSuspended = 0;
+		handler->ErrCode = TW_MT_ARB_LOST;
+		TWI_MasterCplt(handler);
+		return;
+	}
+
+	if(handler->Init.ArbBackoff != 0 && (int32_t)(Tick_Get() - handler->BackoffTick) < 0){
+		// stay addressable as slave meanwhile, TWI_PollHandler resumes later
+		handler->Instance->TWCR_REG = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT);
+		handler->State = TWI_STATE_BACKOFF;
+		return;
+	}
+
+	handler->ArbSuspended = 0;
+	TWI_MasterRewind(handler);
+	// while the bus is busy the hardware holds the start until a stop is seen
+	handler->Instance->TWCR_REG = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
+}
+
+static void TWI_ScanNext(twi_handler_t *handler, uint8_t present){
+	uint8_t addr = handler->Slarw >> 1;
+
+	if(present){
+		handler->ScanBitmap[addr >> 3] |= _BV(addr & 0x07);
+	}
+
+	if(addr < handler->ScanLast){
+		// stop followed by start, probe next address
+		handler->Slarw = ((addr + 1) << 1) | TW_WRITE;
+		if(handler->Init.Timeout != 0){
+			handler->TxnTick = Tick_Get();
+		}
+		handler->Instance->TWCR_REG = _BV(TWINT) | _BV(TWSTO) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+	}
+	else {
+		TWI_ScanDone(handler);
+	}
+}
+
+static void TWI_ScanDone(twi_handler_t *handler){
+	if(handler->ErrCode == TW_MT_ARB_LOST){
+		TWI_ReleaseBus(handler);
+	}
+	else if(handler->TxnHead != NULL){
+		TWI_TxnLoad(handler);
+		handler->Instance->TWCR_REG = _BV(TWINT) | _BV(TWSTO) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+	}
+	else {
+		TWI_Stop(handler);
+	}
+
+	if(handler->ScanCpltCallback != NULL){
+		handler->ScanCpltCallback(handler);
+	}
+}
+
+static void TWI_TxnLoad(twi_handler_t *handler){
+	// pop queue head and make it the running transaction
+	twi_txn_t *txn = handler->TxnHead;
+	handler->TxnHead = txn->Next;
+	if(handler->TxnHead == NULL){
+		handler->TxnTail = NULL;
+	}
+
+	txn->Status = TWI_TXN_BUSY;
+	handler->TxnActive = txn;
+	TWI_MasterSetup(handler, txn->DeviceAddr, NULL, 0, txn->pTxData, txn->TxSize, txn->pRxData, txn->RxSize, !(txn->Flags & TWI_TXN_NO_STOP));
+}
+
 static void TWI_StartTxn(twi_handler_t *handler){
 	if(handler->InRepStart) {
 		handler->InRepStart = 0;
+		handler->InRepStartDirect = 0;
 		do{
 			handler->Instance->TWDR_REG = handler->Slarw;
 		}while(handler->Instance->TWCR_REG & _BV(TWWC));
@@ -277,6 +637,7 @@ hal_status_t TWI_Init(twi_handler_t *handler){
 	hal_status_t retCode = HAL_OK;
 	__HAL_LOCK(handler);
 
+	TWI_StopDone(handler);
 	if(handler->State == TWI_STATE_RESET || handler->State == TWI_STATE_READY){
 		handler->State = TWI_STATE_READY;
 		handler->ErrCode = TW_NO_INFO;
@@ -292,8 +653,13 @@ hal_status_t TWI_Init(twi_handler_t *handler){
 
 		TWI_SetupGPIO(handler);
 
-		handler->Instance->TWSR_REG &= ~(_BV(TWPS0) | _BV(TWPS1)); // Set clock prescaller to 1
-		handler->Instance->TWBR_REG = TWI_GetTWBR(handler->Init.Clock);
+		if(handler->Init.ClockSpeed != 0){
+			TWI_SetBitRate(handler, handler->Init.ClockSpeed);
+		}
+		else {
+			const uint32_t TWI_FREQ[] = {50000UL, 100000UL, 400000UL};
+			TWI_SetBitRate(handler, TWI_FREQ[handler->Init.Clock]);
+		}
 		// enable twi module, acks, and twi interrupt
 		handler->Instance->TWCR_REG = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
 	}
@@ -307,16 +673,46 @@ hal_status_t TWI_Init(twi_handler_t *handler){
 
 hal_status_t TWI_DeInit(twi_handler_t *handler){
 	__HAL_LOCK(handler);
-	// block until bus is idle
-	while(handler->State != TWI_STATE_READY){
-		continue;
+	// block until bus is idle, a stuck bus is recovered on timeout. Bounded even
+	// with no timeout, a slave transfer or backoff: the module is forced off then
+	hal_tick_t start = Tick_Get();
+	hal_tick_t wait = TWI_DEINIT_TIMEOUT + (hal_tick_t)handler->Init.Timeout * (handler->Init.Retries + 1U);
+	while(TWI_GetState(handler) != TWI_STATE_READY && (Tick_Get() - start) < wait){
+		TWI_PollHandler(handler);
 	}
 
-	handler->Instance->TWCR_REG = 0;
-	handler->ErrCode = TW_NO_INFO;
-	handler->State = TWI_STATE_READY;
+	twi_txn_t *flushed;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		// a poll hook in the tick IRQ must not see a half flushed queue
+		handler->Instance->TWCR_REG = 0;
+		flushed = handler->TxnHead;
+		if(handler->TxnActive != NULL){
+			handler->TxnActive->Next = flushed;
+			flushed = handler->TxnActive;
+		}
+		handler->TxnHead = NULL;
+		handler->TxnTail = NULL;
+		handler->TxnActive = NULL;
+		handler->InRepStart = 0;
+		handler->InRepStartDirect = 0;
+		handler->ErrCode = TW_NO_INFO;
+		handler->State = TWI_STATE_RESET;
+	}
 	handler->Instance->TWAR_REG = 0xFE;
 	handler->Instance->TWAMR_REG = 0x00;
+
+	// fail the flushed transactions, their owners may be waiting on them
+	while(flushed != NULL){
+		twi_txn_t *txn = flushed;
+		flushed = txn->Next;
+		txn->ErrCode = TWI_STATUS_ABORTED;
+		txn->XferCount = 0;
+		txn->Status = TWI_TXN_ERROR;
+		if(txn->Callback != NULL){
+			txn->Callback(handler, txn);
+		}
+	}
 	
 	__HAL_UNLOCK(handler);
 	return HAL_OK;
@@ -331,8 +727,14 @@ twi_error_t TWI_GetError(twi_handler_t *handler){
 			return TWI_ERR_ARB_LOST;
 
 		case TW_MT_DATA_NACK:
+		case TW_SR_DATA_NACK:
+		case TW_SR_GCALL_DATA_NACK:
+		case TW_ST_DATA_NACK:
 			return TWI_ERR_DATA_NACK;
 
+		case TW_ST_LAST_DATA:
+			return TWI_ERR_LAST_DATA;
+
 		case TW_MT_SLA_NACK:
 		case TW_MR_SLA_NACK:
 			return TWI_ERR_SLA_NACK;
@@ -340,66 +742,321 @@ twi_error_t TWI_GetError(twi_handler_t *handler){
 		case TW_BUS_ERROR:
 			return TWI_ERR_BUS;
 
+		case TWI_STATUS_TIMEOUT:
+			return TWI_ERR_TIMEOUT;
+
 		default:
 			return TWI_ERR_NONE;
 	}
 }
 
+uint16_t TWI_GetTransferCount(twi_handler_t *handler){
+	uint16_t count;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		count = handler->XferCount;
+	}
+	return count;
+}
+
+uint32_t TWI_GetClockFreq(twi_handler_t *handler){
+	return handler->ClockFreq;
+}
+
 twi_state_t TWI_GetState(twi_handler_t *handler){
+	TWI_StopDone(handler);
 	return handler->State;
 }
 
-hal_status_t TWI_MasterTransmit(twi_handler_t *handler, uint8_t DeviceAddr, uint8_t *pData, uint8_t Size, uint8_t SendStop){
-	if(pData == NULL || Size == 0){
-		return HAL_ERROR;
+static void TWI_MasterSetup(twi_handler_t *handler, uint8_t DeviceAddr, const uint8_t *pHeader, uint8_t HeaderSize, uint8_t *pTxData, uint16_t TxSize, uint8_t *pRxData, uint16_t RxSize, uint8_t SendStop){
+	// header is copied inline, payload is sent straight from the caller buffer
+	for(uint8_t i = 0; i < HeaderSize; i++){
+		handler->Header[i] = pHeader[i];
 	}
-	
+	handler->HeaderSize = HeaderSize;
+
+	// Transaction begins with SLA+W whenever there is something to write
+	uint8_t write = (HeaderSize != 0 || TxSize != 0);
+	handler->State = write ? TWI_STATE_MTX : TWI_STATE_MRX;
+	handler->ErrCode = TW_NO_INFO;
+	handler->SendStop = SendStop;
+	handler->Slarw = ((DeviceAddr << 1) | (write ? TW_WRITE : TW_READ));
+	handler->HeaderIndex = 0;
+	handler->TxBuffPtr = pTxData;
+	handler->TxBuffIndex = 0;
+	handler->TxBuffSize = TxSize;
+	handler->RxBuffPtr = pRxData;
+	handler->RxBuffIndex = 0;
+	handler->RxBuffSize = RxSize;
+	handler->RetryCount = 0;
+	handler->ArbCount = 0;
+	handler->ArbSuspended = 0;
+	if(handler->Init.Timeout != 0){
+		handler->TxnTick = Tick_Get();
+	}
+}
+
+static void TWI_MasterRewind(twi_handler_t *handler){
+	// restart running transaction from its first byte
+	uint8_t write = (handler->HeaderSize != 0 || handler->TxBuffSize != 0);
+	handler->State = write ? TWI_STATE_MTX : TWI_STATE_MRX;
+	handler->ErrCode = TW_NO_INFO;
+	handler->Slarw = (handler->Slarw & ~TW_READ) | (write ? TW_WRITE : TW_READ);
+	handler->HeaderIndex = 0;
+	handler->TxBuffIndex = 0;
+	handler->RxBuffIndex = 0;
+	handler->InRepStart = 0;
+	handler->InRepStartDirect = 0;
+	if(handler->Init.Timeout != 0){
+		handler->TxnTick = Tick_Get();
+	}
+}
+
+static hal_status_t TWI_MasterStart(twi_handler_t *handler, uint8_t DeviceAddr, const uint8_t *pHeader, uint8_t HeaderSize, uint8_t *pTxData, uint16_t TxSize, uint8_t *pRxData, uint16_t RxSize, uint8_t SendStop){
 	hal_status_t retCode = HAL_OK;
 	__HAL_LOCK(handler);
 	
-	if(handler->State == TWI_STATE_READY){
-		handler->State = TWI_STATE_MTX;
-		handler->ErrCode = TW_NO_INFO;
-		handler->SendStop = SendStop;
-		handler->Slarw = ((DeviceAddr << 1) | TW_WRITE);
-		handler->TxRxBuffIndex = 0;
-		handler->TxRxBuffPtr = pData;
-		handler->TxRxBuffSize = Size;
-		TWI_StartTxn(handler);
-	}
-	else {
-		retCode = HAL_BUSY;
+	TWI_StopDone(handler);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->State == TWI_STATE_READY){
+			TWI_MasterSetup(handler, DeviceAddr, pHeader, HeaderSize, pTxData, TxSize, pRxData, RxSize, SendStop);
+			TWI_StartTxn(handler);
+		}
+		else {
+			retCode = HAL_BUSY;
+		}
 	}
 
 	__HAL_UNLOCK(handler);
 	return retCode;
 }
 
-hal_status_t TWI_MasterReceive(twi_handler_t *handler, uint8_t DeviceAddr, uint8_t *pData, uint8_t Size, uint8_t SendStop){
+static uint8_t TWI_SetMemAddr(uint8_t *pHeader, uint16_t MemAddr, twi_memaddr_size_t MemAddrSize){
+	if(MemAddrSize == TWI_MEMADD_SIZE_16BIT){
+		pHeader[0] = (uint8_t)(MemAddr >> 8);
+		pHeader[1] = (uint8_t)(MemAddr);
+		return 2;
+	}
+
+	pHeader[0] = (uint8_t)(MemAddr);
+	return 1;
+}
+
+hal_status_t TWI_MasterTransmit(twi_handler_t *handler, uint8_t DeviceAddr, uint8_t *pData, uint16_t Size, uint8_t SendStop){
 	if(pData == NULL || Size == 0){
 		return HAL_ERROR;
 	}
-	
+	if(TWI_GetState(handler) != TWI_STATE_READY){
+		return HAL_BUSY;
+	}
+
+	return TWI_MasterStart(handler, DeviceAddr, NULL, 0, pData, Size, NULL, 0, SendStop);
+}
+
+hal_status_t TWI_MasterReceive(twi_handler_t *handler, uint8_t DeviceAddr, uint8_t *pData, uint16_t Size, uint8_t SendStop){
+	if(pData == NULL || Size == 0){
+		return HAL_ERROR;
+	}
+	if(TWI_GetState(handler) != TWI_STATE_READY){
+		return HAL_BUSY;
+	}
+
+	return TWI_MasterStart(handler, DeviceAddr, NULL, 0, NULL, 0, pData, Size, SendStop);
+}
+
+hal_status_t TWI_MasterTransmitHdr(twi_handler_t *handler, uint8_t DeviceAddr, const uint8_t *pHeader, uint8_t HeaderSize, uint8_t *pData, uint16_t Size, uint8_t SendStop){
+	if(HeaderSize > TWI_HEADER_SIZE || (HeaderSize != 0 && pHeader == NULL) || (Size != 0 && pData == NULL) || (HeaderSize == 0 && Size == 0)){
+		return HAL_ERROR;
+	}
+	if(TWI_GetState(handler) != TWI_STATE_READY){
+		return HAL_BUSY;
+	}
+
+	return TWI_MasterStart(handler, DeviceAddr, pHeader, HeaderSize, pData, Size, NULL, 0, SendStop);
+}
+
+hal_status_t TWI_MemWrite(twi_handler_t *handler, uint8_t DeviceAddr, uint16_t MemAddr, twi_memaddr_size_t MemAddrSize, uint8_t *pData, uint16_t Size){
+	if(pData == NULL || Size == 0){
+		return HAL_ERROR;
+	}
+	if(TWI_GetState(handler) != TWI_STATE_READY){
+		return HAL_BUSY;
+	}
+
+	uint8_t header[2];
+	uint8_t size = TWI_SetMemAddr(header, MemAddr, MemAddrSize);
+	return TWI_MasterStart(handler, DeviceAddr, header, size, pData, Size, NULL, 0, 1);
+}
+
+hal_status_t TWI_MemRead(twi_handler_t *handler, uint8_t DeviceAddr, uint16_t MemAddr, twi_memaddr_size_t MemAddrSize, uint8_t *pData, uint16_t Size){
+	if(pData == NULL || Size == 0){
+		return HAL_ERROR;
+	}
+	if(TWI_GetState(handler) != TWI_STATE_READY){
+		return HAL_BUSY;
+	}
+
+	uint8_t header[2];
+	uint8_t size = TWI_SetMemAddr(header, MemAddr, MemAddrSize);
+	return TWI_MasterStart(handler, DeviceAddr, header, size, NULL, 0, pData, Size, 1);
+}
+
+void TWI_PollHandler(twi_handler_t *handler){
+	// a stop already off the bus is not a timeout
+	TWI_StopDone(handler);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		// arbitration backoff over, unless a slave event is pending
+		if(handler->State == TWI_STATE_BACKOFF && !(handler->Instance->TWCR_REG & _BV(TWINT))){
+			TWI_ArbResume(handler);
+		}
+	}
+
+	if(handler->Init.Timeout == 0){
+		return;
+	}
+
+	twi_state_t state;
+	uint8_t expired = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		state = handler->State;
+		if((state == TWI_STATE_MTX || state == TWI_STATE_MRX || state == TWI_STATE_STOP || state == TWI_STATE_SCAN) &&
+			(Tick_Get() - handler->TxnTick) >= handler->Init.Timeout){
+			// no more TWI interrupts from here
+			handler->Instance->TWCR_REG = 0;
+			expired = 1;
+		}
+	}
+
+	if(!expired){
+		return;
+	}
+
+	TWI_BusRecover(handler);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(state == TWI_STATE_STOP){
+			handler->State = TWI_STATE_READY;
+			if(handler->TxnHead != NULL){
+				TWI_TxnLoad(handler);
+				TWI_StartTxn(handler);
+			}
+		}
+		else if(state == TWI_STATE_SCAN){
+			handler->ErrCode = TWI_STATUS_TIMEOUT;
+			TWI_ScanDone(handler);
+		}
+		else if(handler->RetryCount < handler->Init.Retries){
+			handler->RetryCount++;
+			TWI_MasterRewind(handler);
+			TWI_StartTxn(handler);
+		}
+		else {
+			handler->ErrCode = TWI_STATUS_TIMEOUT;
+			TWI_MasterCplt(handler);
+		}
+	}
+}
+
+hal_status_t TWI_ScanBus(twi_handler_t *handler, uint8_t FirstAddr, uint8_t LastAddr, uint8_t *pBitmap){
+	if(pBitmap == NULL || FirstAddr > LastAddr || LastAddr > 0x7F){
+		return HAL_ERROR;
+	}
+
 	hal_status_t retCode = HAL_OK;
 	__HAL_LOCK(handler);
-	
-	if(handler->State == TWI_STATE_READY){
-		handler->State = TWI_STATE_MRX;
-		handler->ErrCode = TW_NO_INFO;
-		handler->SendStop = SendStop;
-		handler->Slarw = ((DeviceAddr << 1) | TW_READ);
-		handler->TxRxBuffPtr = pData;
-		handler->TxRxBuffIndex = 0;
-		handler->TxRxBuffSize = Size-1; // This is not intuitive, read on...
-		// On receive, the previously configured ACK/NACK setting is transmitted in
-		// response to the received byte before the interrupt is signalled. 
-		// Therefor we must actually set NACK when the _next_ to last byte is
-		// received, causing that NACK to be sent in response to receiving the last
-		// expected byte of data.
-		TWI_StartTxn(handler);
+
+	TWI_StopDone(handler);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->State == TWI_STATE_READY){
+			for(uint8_t addr = FirstAddr; addr <= LastAddr; addr++){
+				pBitmap[addr >> 3] &= ~_BV(addr & 0x07);
+			}
+
+			handler->State = TWI_STATE_SCAN;
+			handler->ErrCode = TW_NO_INFO;
+			handler->ScanBitmap = pBitmap;
+			handler->ScanLast = LastAddr;
+			handler->Slarw = (FirstAddr << 1) | TW_WRITE;
+			if(handler->Init.Timeout != 0){
+				handler->TxnTick = Tick_Get();
+			}
+			TWI_StartTxn(handler);
+		}
+		else {
+			retCode = HAL_BUSY;
+		}
 	}
-	else {
-		retCode = HAL_BUSY;
+
+	__HAL_UNLOCK(handler);
+	return retCode;
+}
+
+hal_status_t TWI_QueueTxn(twi_handler_t *handler, twi_txn_t *txn){
+	if(txn == NULL || (txn->TxSize == 0 && txn->RxSize == 0)){
+		return HAL_ERROR;
+	}
+	if((txn->TxSize != 0 && txn->pTxData == NULL) || (txn->RxSize != 0 && txn->pRxData == NULL)){
+		return HAL_ERROR;
+	}
+
+	hal_status_t retCode = HAL_OK;
+
+	txn->Next = NULL;
+	txn->ErrCode = TW_NO_INFO;
+	txn->Status = TWI_TXN_PENDING;
+
+	TWI_StopDone(handler);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->State == TWI_STATE_RESET){
+			// nothing would ever start it
+			retCode = HAL_ERROR;
+		}
+		else {
+			if(handler->TxnTail != NULL){
+				handler->TxnTail->Next = txn;
+			}
+			else {
+				handler->TxnHead = txn;
+			}
+			handler->TxnTail = txn;
+
+			// otherwise started from the completion path of the running transfer,
+			// or by TWI_StopDone once a stop still on the bus is over
+			if(handler->State == TWI_STATE_READY && !handler->InRepStartDirect){
+				TWI_TxnLoad(handler);
+				TWI_StartTxn(handler);
+			}
+		}
+	}
+
+	if(handler->State == TWI_STATE_STOP){
+		TWI_StopWait(handler);
+	}
+
+	return retCode;
+}
+
+hal_status_t TWI_SlaveRegMap(twi_handler_t *handler, uint8_t *pRegs, uint16_t Size, const uint8_t *pWriteProtect, twi_memaddr_size_t PtrSize){
+	if(pRegs != NULL && Size == 0){
+		return HAL_ERROR;
+	}
+
+	hal_status_t retCode = HAL_OK;
+	__HAL_LOCK(handler);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(handler->State == TWI_STATE_SRX || handler->State == TWI_STATE_STX){
+			retCode = HAL_BUSY;
+		}
+		else {
+			handler->RegMap = pRegs;
+			handler->RegMapSize = Size;
+			handler->RegMapWP = pWriteProtect;
+			handler->RegPtrSize = PtrSize;
+			handler->RegPtr = 0;
+			handler->RegPtrIndex = 0;
+		}
 	}
 
 	__HAL_UNLOCK(handler);
@@ -461,6 +1118,10 @@ void TWI_RegisterCallback(twi_handler_t *handler, twi_callback_id_t CallbackID,
 			handler->SlaveRxCpltCallback = Callback;
 			break;
 
+		case TWI_SCAN_COMPLETE_CB_ID:
+			handler->ScanCpltCallback = Callback;
+			break;
+
 		case TWI_ERROR_CB_ID:
 			handler->ErrorCallback = Callback;
 			break;
@@ -489,6 +1150,10 @@ void TWI_UnRegisterCallback(twi_handler_t *handler, twi_callback_id_t CallbackID
 			handler->SlaveRxCpltCallback = NULL;
 			break;
 
+		case TWI_SCAN_COMPLETE_CB_ID:
+			handler->ScanCpltCallback = NULL;
+			break;
+
 		case TWI_ERROR_CB_ID:
 			handler->ErrorCallback = NULL;
 			break;
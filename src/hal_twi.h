@@ -6,18 +6,40 @@ extern "C" {
 #endif
 
 #include "hal_def.h"
+#include "hal_tick.h"
+#include <util/delay.h>
 
 
 #define TWI_GENERALCALL_DISABLE	0
 #define TWI_GENERALCALL_ENABLE	_BV(TWGCE)
 
+#define TWI_HEADER_SIZE			4		// inline header bytes sent ahead of the payload
+
+#define TWI_STATUS_TIMEOUT		0x01	// ErrCode on timeout, TW_* status codes are multiples of 8
+#define TWI_STATUS_ABORTED		0x02	// txn ErrCode when flushed by TWI_DeInit
+
+#ifndef TWI_STOP_WAIT_PERIODS
+	#define TWI_STOP_WAIT_PERIODS	4	// SCL periods TWI_QueueTxn waits for a stop to leave the bus
+#endif
+
+#ifndef TWI_DEINIT_TIMEOUT
+	#define TWI_DEINIT_TIMEOUT		100	// ms TWI_DeInit waits for the bus on top of Init.Timeout and retries
+#endif
+
+#ifndef TWI_RECOVERY_HALF_PERIOD_US
+	#define TWI_RECOVERY_HALF_PERIOD_US	5	// bus recovery SCL half period (100kHz)
+#endif
+
 typedef enum {
 	TWI_STATE_RESET,
 	TWI_STATE_READY,
 	TWI_STATE_MRX,
 	TWI_STATE_MTX,
 	TWI_STATE_SRX,
-	TWI_STATE_STX
+	TWI_STATE_STX,
+	TWI_STATE_STOP,		// stop condition issued, still being executed on the bus
+	TWI_STATE_SCAN,		// bus scan ongoing
+	TWI_STATE_BACKOFF	// arbitration lost, waiting to retry the master transaction
 }twi_state_t;
 
 typedef enum {
@@ -25,7 +47,8 @@ typedef enum {
 	TWI_MASTER_RX_COMPLETE_CB_ID,
 	TWI_SLAVE_TX_COMPLETE_CB_ID,
 	TWI_SLAVE_RX_COMPLETE_CB_ID,
-	TWI_ERROR_CB_ID
+	TWI_ERROR_CB_ID,
+	TWI_SCAN_COMPLETE_CB_ID
 }twi_callback_id_t;
 
 typedef enum {
@@ -45,14 +68,53 @@ typedef enum {
 	TWI_ERR_DATA_NACK,
 	TWI_ERR_ARB_LOST,
 	TWI_ERR_BUS,
+	TWI_ERR_TIMEOUT,
+	TWI_ERR_LAST_DATA,			// slave transmitter ran out of data, master asked for more
 }twi_error_t;
 
+typedef enum {
+	TWI_MEMADD_SIZE_8BIT = 1,
+	TWI_MEMADD_SIZE_16BIT = 2
+}twi_memaddr_size_t;
+
+#define TWI_TXN_NO_STOP		_BV(0)	// end with a repeated start instead of a stop
+
+typedef enum {
+	TWI_TXN_PENDING,
+	TWI_TXN_BUSY,
+	TWI_TXN_DONE,
+	TWI_TXN_ERROR
+}twi_txn_status_t;
+
+struct _twi_handler;
+
+typedef struct _twi_txn {
+	uint8_t DeviceAddr;
+	uint8_t *pTxData;			// write segment, sent first
+	uint16_t TxSize;
+	uint8_t *pRxData;			// read segment, after a repeated start
+	uint16_t RxSize;
+	uint8_t Flags;
+	volatile twi_txn_status_t Status;
+	uint8_t ErrCode;
+	uint16_t XferCount;			// bytes read, or bytes acknowledged on write
+	void (*Callback)(struct _twi_handler *handler, struct _twi_txn *txn);	// called from IRQ, may queue another transaction
+	struct _twi_txn *Next;
+}twi_txn_t;
+
 typedef struct {
 	twi_mode_t Mode;
 	twi_clock_t Clock;
+	uint32_t ClockSpeed;		// SCL frequency in Hz, overrides Clock when not 0
 	uint8_t OwnAddress;
 	uint8_t OwnAddressMask;
 	uint8_t GeneralCallMode;
+	uint16_t Timeout;			// master transaction timeout in ms (Tick_Get), 0 disables. Armed once per
+								// transaction, not per byte: must cover the whole transfer at the bus speed
+	uint8_t Retries;			// retries after a timeout and bus recovery
+	uint8_t MultiMaster;		// retry master transactions on arbitration loss
+	uint8_t ArbRetries;			// arbitration loss retries before reporting TWI_ERR_ARB_LOST
+	uint8_t ArbBackoff;			// max random backoff in ms before a retry (Tick_Get), 0 retries at next stop
 }twi_init_t;
 
 typedef struct _twi_handler {
@@ -61,12 +123,55 @@ typedef struct _twi_handler {
 	hal_lock_t Lock;
 
 	volatile uint8_t ErrCode;
-	volatile twi_state_t State;
+	volatile twi_state_t State;	// use TWI_GetState, a stop already off the bus still reads TWI_STATE_STOP here
+	uint32_t ClockFreq;			// actual SCL frequency
+	volatile uint16_t XferCount;	// bytes moved by the last transfer, master or slave
 	
 	uint8_t Slarw;
 	volatile uint8_t SendStop;
 	volatile uint8_t InRepStart;
-
+	volatile uint8_t InRepStartDirect;	// repeated start held by a direct transfer, the queue waits for its follow-up
+
+	/* Master: inline header (e.g. memory address), write payload then repeated start read */
+	uint8_t Header[TWI_HEADER_SIZE];
+	uint8_t HeaderSize;
+	volatile uint8_t HeaderIndex;
+
+	uint8_t *TxBuffPtr;
+	volatile uint16_t TxBuffIndex;
+	uint16_t TxBuffSize;
+
+	uint8_t *RxBuffPtr;
+	volatile uint16_t RxBuffIndex;
+	uint16_t RxBuffSize;
+
+	hal_tick_t TxnTick;			// transaction start time, see Init.Timeout
+	uint8_t RetryCount;
+
+	/* Multi-master */
+	volatile uint8_t ArbSuspended;
+	uint8_t ArbCount;
+	uint8_t ArbSeed;
+	hal_tick_t BackoffTick;
+
+	/* Transaction queue */
+	twi_txn_t *TxnHead;
+	twi_txn_t *TxnTail;
+	twi_txn_t *volatile TxnActive;
+
+	/* Bus scan */
+	uint8_t *ScanBitmap;
+	uint8_t ScanLast;
+
+	/* Slave register map */
+	uint8_t *RegMap;
+	uint16_t RegMapSize;
+	const uint8_t *RegMapWP;	// write protect bitmap, bit set = read only register
+	uint8_t RegPtrSize;
+	volatile uint16_t RegPtr;
+	volatile uint8_t RegPtrIndex;
+
+	/* Slave buffer */
 	uint8_t *TxRxBuffPtr;
 	volatile uint8_t TxRxBuffIndex;
 	uint8_t TxRxBuffSize;
@@ -77,6 +182,7 @@ typedef struct _twi_handler {
 	void (*SlaveRxCpltCallback)(struct _twi_handler *handler);
 	void (*AddrCallback)(struct _twi_handler *handler, uint8_t TransferDirection);
 	void (*ErrorCallback)(struct _twi_handler *handler);
+	void (*ScanCpltCallback)(struct _twi_handler *handler);
 }twi_handler_t;
 
 
@@ -89,10 +195,35 @@ hal_status_t TWI_Init(twi_handler_t *handler);
 hal_status_t TWI_DeInit(twi_handler_t *handler);
 
 twi_error_t TWI_GetError(twi_handler_t *handler);
+// The only valid way to read the state: a stop raises no interrupt, TWI_STATE_STOP turns
+// into TWI_STATE_READY here, in TWI_PollHandler or on the next bus event
 twi_state_t TWI_GetState(twi_handler_t *handler);
+uint32_t TWI_GetClockFreq(twi_handler_t *handler);
+uint16_t TWI_GetTransferCount(twi_handler_t *handler);
+
+hal_status_t TWI_MasterTransmit(twi_handler_t *handler, uint8_t DeviceAddr, uint8_t *pData, uint16_t Size, uint8_t SendStop);
+hal_status_t TWI_MasterReceive(twi_handler_t *handler, uint8_t DeviceAddr, uint8_t *pData, uint16_t Size, uint8_t SendStop);
+// Send HeaderSize (up to TWI_HEADER_SIZE) header bytes then Size payload bytes from pData, no copy
+hal_status_t TWI_MasterTransmitHdr(twi_handler_t *handler, uint8_t DeviceAddr, const uint8_t *pHeader, uint8_t HeaderSize, uint8_t *pData, uint16_t Size, uint8_t SendStop);
+
+hal_status_t TWI_MemWrite(twi_handler_t *handler, uint8_t DeviceAddr, uint16_t MemAddr, twi_memaddr_size_t MemAddrSize, uint8_t *pData, uint16_t Size);
+hal_status_t TWI_MemRead(twi_handler_t *handler, uint8_t DeviceAddr, uint16_t MemAddr, twi_memaddr_size_t MemAddrSize, uint8_t *pData, uint16_t Size);
+
+// Call periodically (timer IRQ or main loop): timeouts, bus recovery, retries and arbitration backoff
+void TWI_PollHandler(twi_handler_t *handler);
+
+// Probe FirstAddr..LastAddr with SLA+W, presence bit (addr & 7) of pBitmap[addr >> 3], 16 bytes
+hal_status_t TWI_ScanBus(twi_handler_t *handler, uint8_t FirstAddr, uint8_t LastAddr, uint8_t *pBitmap);
+
+// Append txn to the queue, never waits for a transfer. A stop still on the bus is waited
+// for up to TWI_STOP_WAIT_PERIODS SCL periods, then the txn starts from the next
+// TWI_GetState or TWI_PollHandler call, or the next bus event. Behind a repeated start
+// held by a direct transfer (SendStop 0) it starts once that caller ends with a stop.
+// HAL_ERROR before TWI_Init or after TWI_DeInit, which fails the queued ones (TWI_STATUS_ABORTED)
+hal_status_t TWI_QueueTxn(twi_handler_t *handler, twi_txn_t *txn);
 
-hal_status_t TWI_MasterTransmit(twi_handler_t *handler, uint8_t DeviceAddr, uint8_t *pData, uint8_t Size, uint8_t SendStop);
-hal_status_t TWI_MasterReceive(twi_handler_t *handler, uint8_t DeviceAddr, uint8_t *pData, uint8_t Size, uint8_t SendStop);
+// Serve pRegs as an EEPROM-like register map from the IRQ, pRegs NULL disables it
+hal_status_t TWI_SlaveRegMap(twi_handler_t *handler, uint8_t *pRegs, uint16_t Size, const uint8_t *pWriteProtect, twi_memaddr_size_t PtrSize);
 
 hal_status_t TWI_SlaveTransmit(twi_handler_t *handler, uint8_t *pData, uint8_t Size);
 hal_status_t TWI_SlaveReceive(twi_handler_t *handler, uint8_t *pData, uint8_t Size);
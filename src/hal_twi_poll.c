@@ -0,0 +1,128 @@
+/**
+ * @file hal_twi_poll.c
+ * @author Matheus Alencar Nascimento (matt-alencar)
+ * @brief This file provides a periodic register polling service on top of
+ *        TWI HAL driver transaction queue:
+ *           + Initialization function
+ *           + Scheduler, run from the tick timer or main loop
+ *           + Double-buffered snapshot read functions
+ *
+ **************************************************************************
+ * @copyright MIT License.
+ *
+ */
+
+#include "hal_twi_poll.h"
+
+
+/* PRIVATE FUNCTIONS */
+static void TWIPoll_TxnCallback(twi_handler_t *twi, twi_txn_t *txn);
+/* END OF PRIVATE FUNCTIONS */
+
+
+static void TWIPoll_TxnCallback(twi_handler_t *twi, twi_txn_t *txn){
+	(void)twi;
+	// Txn is the first member of the job
+	twi_poll_job_t *job = (twi_poll_job_t *)txn;
+
+	if(txn->Status == TWI_TXN_DONE){
+		// sample was read into the back buffer, publish it
+		job->Front ^= 1;
+		if(++job->Seq == 0)
+			job->Seq = 1;	// 0 stays "no sample yet"
+	}
+	else {
+		job->ErrCount++;
+	}
+
+	job->Busy = 0;
+}
+
+hal_status_t TWIPoll_Init(twi_poll_handler_t *handler){
+	if(handler == NULL || handler->Twi == NULL || (handler->Jobs == NULL && handler->JobCount != 0)){
+		return HAL_ERROR;
+	}
+
+	hal_tick_t now = Tick_Get();
+
+	for(uint8_t i = 0; i < handler->JobCount; i++){
+		twi_poll_job_t *job = &handler->Jobs[i];
+		if(job->Size == 0 || job->Size > TWI_POLL_MAX_SIZE){
+			return HAL_ERROR;
+		}
+
+		job->Front = 0;
+		job->Seq = 0;
+		job->ErrCount = 0;
+		job->Busy = 0;
+		job->NextTick = now;
+
+		job->Txn.DeviceAddr = job->DeviceAddr;
+		job->Txn.pTxData = &job->Reg;
+		job->Txn.TxSize = 1;
+		job->Txn.RxSize = job->Size;
+		job->Txn.Flags = 0;
+		job->Txn.Callback = TWIPoll_TxnCallback;
+	}
+
+	return HAL_OK;
+}
+
+void TWIPoll_Handler(twi_poll_handler_t *handler){
+	hal_tick_t now = Tick_Get();
+
+	// settles a stop that is over, starting the jobs queued behind it
+	TWI_GetState(handler->Twi);
+
+	for(uint8_t i = 0; i < handler->JobCount; i++){
+		twi_poll_job_t *job = &handler->Jobs[i];
+
+		if(job->Busy || (int32_t)(now - job->NextTick) < 0){
+			continue;
+		}
+
+		job->NextTick += job->Period;
+		if((int32_t)(now - job->NextTick) >= 0){
+			// fell behind (bus busy or long errors), do not burst to catch up
+			job->NextTick = now + job->Period;
+		}
+
+		// read into the back buffer
+		job->Txn.pRxData = job->Buffer[job->Front ^ 1];
+		job->Busy = 1;
+		if(TWI_QueueTxn(handler->Twi, &job->Txn) != HAL_OK){
+			job->Busy = 0;
+		}
+	}
+}
+
+static inline uint16_t TWIPoll_GetSeq(twi_poll_job_t *job){
+	uint16_t seq;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		seq = job->Seq;
+	}
+	return seq;
+}
+
+hal_status_t TWIPoll_Read(twi_poll_job_t *job, uint8_t *pData, uint16_t *pSeq){
+	uint16_t seq;
+
+	do {
+		seq = TWIPoll_GetSeq(job);
+		if(seq == 0){
+			return HAL_ERROR;
+		}
+
+		const uint8_t *src = job->Buffer[job->Front];
+		for(uint8_t i = 0; i < job->Size; i++){
+			pData[i] = src[i];
+		}
+		// a sample published while copying may have reused this buffer
+	} while(seq != TWIPoll_GetSeq(job));
+
+	if(pSeq != NULL){
+		*pSeq = seq;
+	}
+
+	return HAL_OK;
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+/**
+ * @file hal_twi_poll.h
+ * @author Matheus Alencar Nascimento (matt-alencar)
+ * @brief Header file of TWI periodic register polling service.
+ **************************************************************************
+ * @copyright MIT License.
+ *
+ */
+
+#ifndef _TWI_POLL_DRIVER_H_
+#define _TWI_POLL_DRIVER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "hal_twi.h"
+#include "hal_tick.h"
+
+
+/**
+ * @brief Maximum sample size of a polling job
+ */
+#ifndef TWI_POLL_MAX_SIZE
+	#define TWI_POLL_MAX_SIZE		8
+#endif
+
+
+/**
+ * @brief Periodic read job: read Size bytes from register Reg of device
+ *        DeviceAddr every Period ms
+ */
+typedef struct _twi_poll_job {
+	twi_txn_t Txn;											/*!< Queue descriptor, must be the first member */
+	uint8_t DeviceAddr;										/*!< 7-bit device address */
+	uint8_t Reg;											/*!< Register address */
+	uint8_t Size;											/*!< Sample size, up to TWI_POLL_MAX_SIZE */
+	uint16_t Period;										/*!< Poll period in ms */
+
+	uint8_t Buffer[2][TWI_POLL_MAX_SIZE];					/*!< Snapshot double buffer */
+	volatile uint8_t Front;									/*!< Buffer holding the latest sample */
+	volatile uint16_t Seq;									/*!< Sample sequence counter, 0 until first sample */
+	volatile uint8_t ErrCount;								/*!< Failed reads counter */
+	volatile uint8_t Busy;									/*!< Read queued or ongoing */
+	hal_tick_t NextTick;									/*!< Next poll time */
+}twi_poll_job_t;
+
+/**
+ * @brief TWI polling service handle Structure definition
+ */
+typedef struct {
+	twi_handler_t *Twi;										/*!< TWI bus handler, must be initialized as master */
+	twi_poll_job_t *Jobs;									/*!< Job table */
+	uint8_t JobCount;										/*!< Job table size */
+}twi_poll_handler_t;
+
+
+/**
+ * @brief Initializes the polling service, first reads are due immediately
+ *
+ * @param handler TWI Poll Handler Pointer
+ * @return HAL Status
+ */
+hal_status_t TWIPoll_Init(twi_poll_handler_t *handler);
+
+
+/**
+ * @brief Scheduler
+ * @note Should be called periodically (tick timer IRQ or main loop). Due jobs
+ *       are queued on the TWI transaction queue and read in background,
+ *       a job is skipped while its previous read is still pending.
+ *       Never waits for the bus: jobs queued behind a stop still on the bus
+ *       are started by the next call.
+ *
+ * @param handler TWI Poll Handler Pointer
+ */
+void TWIPoll_Handler(twi_poll_handler_t *handler);
+
+
+/**
+ * @brief Copy the latest consistent sample of a job
+ * @note Never waits for the bus, can be called from any context
+ *
+ * @param job Polling job Pointer
+ * @param[out] pData Destination buffer, job Size bytes
+ * @param[out] pSeq Sample sequence counter, may be NULL
+ * @return HAL Status: HAL_ERROR if no sample was read yet
+ */
+hal_status_t TWIPoll_Read(twi_poll_job_t *job, uint8_t *pData, uint16_t *pSeq);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TWI_POLL_DRIVER_H_ */
\ No newline at end of file
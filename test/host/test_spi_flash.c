@@ -0,0 +1,241 @@
+/**
+ * @file test_spi_flash.c
+ * @author Matheus Alencar Nascimento (matt-alencar)
+ * @brief Host tests of the SPI Flash driver against the simulated W25Qxx:
+ *           + JEDEC ID
+ *           + Fast read streamed in 255 bytes chunks under one chip select
+ *           + Page program with a second page queued behind the busy cycle
+ *           + Sector, block and chip erase
+ *           + BUSY polling and SPI handler sharing
+ *
+ *        Build and run from this directory with: make
+ **************************************************************************
+ * @copyright MIT License.
+ *
+ */
+
+#include "hal_spi_flash.h"
+#include "w25q_sim.h"
+#include <stdio.h>
+#include <string.h>
+
+
+#define CHECK(cond)		do{ checks++; if(!(cond)){ failures++; printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); } }while(0)
+
+static unsigned checks = 0;
+static unsigned failures = 0;
+
+static gpio_t cs_gpio;
+static spi_handler_t spi;
+static spi_flash_handler_t flash;
+
+static unsigned read_cplt = 0;
+static unsigned program_cplt = 0;
+static unsigned erase_cplt = 0;
+static unsigned error_cplt = 0;
+static unsigned app_cplt = 0;
+
+
+static void OnRead(spi_flash_handler_t *handler){ (void)handler; read_cplt++; }
+static void OnProgram(spi_flash_handler_t *handler){ (void)handler; program_cplt++; }
+static void OnErase(spi_flash_handler_t *handler){ (void)handler; erase_cplt++; }
+static void OnError(spi_flash_handler_t *handler){ (void)handler; error_cplt++; }
+static void OnAppSpi(spi_handler_t *handler){ (void)handler; app_cplt++; }
+
+static void Setup(void){
+	W25QSim_Reset();
+	memset(&spi, 0, sizeof(spi));
+	memset(&flash, 0, sizeof(flash));
+	spi.State = SPI_STATE_READY;
+	spi.TxCpltCallback = OnAppSpi;
+	spi.RxCpltCallback = OnAppSpi;
+
+	flash.Spi = &spi;
+	flash.Init.CSGpio = &cs_gpio;
+	flash.Init.CSPin = GPIO_PIN_0;
+	SPIFlash_Init(&flash);
+	SPIFlash_RegisterCallback(&flash, SPI_FLASH_READ_COMPLETE_CB_ID, OnRead);
+	SPIFlash_RegisterCallback(&flash, SPI_FLASH_PROGRAM_COMPLETE_CB_ID, OnProgram);
+	SPIFlash_RegisterCallback(&flash, SPI_FLASH_ERASE_COMPLETE_CB_ID, OnErase);
+	SPIFlash_RegisterCallback(&flash, SPI_FLASH_ERROR_CB_ID, OnError);
+
+	read_cplt = program_cplt = erase_cplt = error_cplt = app_cplt = 0;
+}
+
+/* Poll like a timer IRQ would, returns the number of polls until READY */
+static unsigned WaitReady(void){
+	unsigned polls = 0;
+
+	W25QSim_Run(&spi);
+	while(SPIFlash_GetState(&flash) != SPI_FLASH_STATE_READY && polls < 10000){
+		SPIFlash_PollHandler(&flash);
+		W25QSim_Run(&spi);
+		polls++;
+	}
+	return polls;
+}
+
+static void Test_JedecID(void){
+	uint8_t id[3] = {0};
+
+	Setup();
+	CHECK(SPIFlash_ReadJedecID(&flash, id) == HAL_OK);
+	WaitReady();
+	CHECK(read_cplt == 1);
+	CHECK(id[0] == 0xEF && id[1] == 0x40 && id[2] == 0x12);
+}
+
+static void Test_FastReadChunks(void){
+	static uint8_t buf[1000];
+
+	Setup();
+	for(uint32_t i = 0; i < sizeof(buf); i++){
+		w25q.Mem[0x1234 + i] = (uint8_t)(i * 7 + 3);
+	}
+
+	CHECK(SPIFlash_Read(&flash, 0x1234, buf, sizeof(buf)) == HAL_OK);
+	CHECK(SPIFlash_GetState(&flash) == SPI_FLASH_STATE_BUSY);
+	CHECK(SPIFlash_Read(&flash, 0, buf, 1) == HAL_BUSY);
+	WaitReady();
+
+	CHECK(read_cplt == 1);
+	CHECK(w25q.RxChunks == 4);						// 255 + 255 + 255 + 235
+	CHECK(w25q.MaxRxChunk == 255);
+	CHECK(w25q.Frames == 1);						// chip select low for the whole read
+	CHECK(w25q.LastFrameBytes == 5 + sizeof(buf));
+	for(uint32_t i = 0; i < sizeof(buf); i++){
+		if(buf[i] != (uint8_t)(i * 7 + 3)){
+			CHECK(buf[i] == (uint8_t)(i * 7 + 3));
+			break;
+		}
+	}
+}
+
+static void Test_PageProgramQueued(void){
+	static uint8_t page0[256];
+	static uint8_t page1[256];
+	static uint8_t back[512];
+
+	Setup();
+	for(uint16_t i = 0; i < 256; i++){
+		page0[i] = (uint8_t)i;
+		page1[i] = (uint8_t)(255 - i);
+	}
+
+	CHECK(SPIFlash_PageProgram(&flash, 0x2000, page0, 256) == HAL_OK);
+	W25QSim_Run(&spi);
+	CHECK(SPIFlash_GetState(&flash) == SPI_FLASH_STATE_BUSY_WRITE);
+	CHECK(w25q.Status & SPI_FLASH_SR_BUSY);
+
+	// second page is queued behind the running cycle, a third one is refused
+	CHECK(SPIFlash_PageProgram(&flash, 0x2100, page1, 256) == HAL_OK);
+	CHECK(SPIFlash_PageProgram(&flash, 0x2200, page1, 256) == HAL_BUSY);
+
+	WaitReady();
+	CHECK(program_cplt == 2);
+	CHECK(w25q.Programs == 2);
+	CHECK(w25q.Ignored == 0);						// nothing sent while the device was busy
+	CHECK(memcmp(&w25q.Mem[0x2000], page0, 256) == 0);
+	CHECK(memcmp(&w25q.Mem[0x2100], page1, 256) == 0);
+
+	CHECK(SPIFlash_Read(&flash, 0x2000, back, sizeof(back)) == HAL_OK);
+	WaitReady();
+	CHECK(memcmp(back, page0, 256) == 0 && memcmp(&back[256], page1, 256) == 0);
+
+	// a write must not cross a page boundary
+	CHECK(SPIFlash_PageProgram(&flash, 0x2080, page0, 256) == HAL_ERROR);
+}
+
+static void Test_Erase(void){
+	Setup();
+	memset(w25q.Mem, 0x00, W25Q_SIM_SIZE);
+
+	CHECK(SPIFlash_SectorErase(&flash, 0x3456) == HAL_OK);
+	CHECK(WaitReady() >= w25q.ErasePolls);
+	CHECK(erase_cplt == 1);
+	CHECK(w25q.Mem[0x2FFF] == 0x00 && w25q.Mem[0x3000] == 0xFF && w25q.Mem[0x3FFF] == 0xFF && w25q.Mem[0x4000] == 0x00);
+
+	CHECK(SPIFlash_BlockErase(&flash, 0x12345) == HAL_OK);
+	WaitReady();
+	CHECK(erase_cplt == 2);
+	CHECK(w25q.Mem[0x0FFFF] == 0x00 && w25q.Mem[0x10000] == 0xFF && w25q.Mem[0x1FFFF] == 0xFF && w25q.Mem[0x20000] == 0x00);
+
+	CHECK(SPIFlash_ChipErase(&flash) == HAL_OK);
+	WaitReady();
+	CHECK(erase_cplt == 3);
+	CHECK(w25q.Mem[0] == 0xFF && w25q.Mem[W25Q_SIM_SIZE - 1] == 0xFF);
+	CHECK(w25q.Erases == 3 && w25q.Ignored == 0);
+}
+
+static void Test_BusyPolling(void){
+	uint8_t data = 0x5A;
+
+	Setup();
+	w25q.ProgramPolls = 5;
+
+	CHECK(SPIFlash_PageProgram(&flash, 0, &data, 1) == HAL_OK);
+	W25QSim_Run(&spi);
+
+	// status is read only when polled, the device stays busy for 5 reads
+	CHECK(w25q.StatusReads == 0);
+	for(uint8_t i = 0; i < 4; i++){
+		SPIFlash_PollHandler(&flash);
+		W25QSim_Run(&spi);
+		CHECK(SPIFlash_GetState(&flash) == SPI_FLASH_STATE_BUSY_WRITE);
+		CHECK(program_cplt == 0);
+	}
+	CHECK(SPIFlash_Read(&flash, 0, &data, 1) == HAL_BUSY);
+
+	SPIFlash_PollHandler(&flash);
+	W25QSim_Run(&spi);
+	SPIFlash_PollHandler(&flash);
+	W25QSim_Run(&spi);
+	CHECK(SPIFlash_GetState(&flash) == SPI_FLASH_STATE_READY);
+	CHECK(program_cplt == 1);
+	CHECK(w25q.StatusReads == 6);
+	CHECK(w25q.Mem[0] == 0x5A);
+}
+
+static void Test_SharedBus(void){
+	uint8_t buf[4];
+
+	Setup();
+
+	// bus taken by another device: refused, nothing touched
+	spi.State = SPI_STATE_BUSY_TX;
+	CHECK(SPIFlash_Read(&flash, 0, buf, sizeof(buf)) == HAL_BUSY);
+	CHECK(spi.TxCpltCallback == OnAppSpi && spi.Owner == NULL);
+	CHECK(w25q.Frames == 0);
+	spi.State = SPI_STATE_READY;
+
+	// previous callbacks are restored once the command is over
+	CHECK(SPIFlash_Read(&flash, 0, buf, sizeof(buf)) == HAL_OK);
+	CHECK(spi.Owner == &flash);
+	WaitReady();
+	CHECK(spi.TxCpltCallback == OnAppSpi && spi.RxCpltCallback == OnAppSpi && spi.Owner == NULL);
+	CHECK(app_cplt == 0 && read_cplt == 1);
+
+	// refused frame in the middle of a command aborts it
+	CHECK(SPIFlash_Read(&flash, 0, buf, sizeof(buf)) == HAL_OK);
+	spi.State = SPI_STATE_BUSY_TX;
+	spi.TxCpltCallback(&spi);
+	CHECK(error_cplt == 1 && !w25q.Selected);
+	CHECK(SPIFlash_GetState(&flash) == SPI_FLASH_STATE_READY);
+	CHECK(spi.TxCpltCallback == OnAppSpi && spi.Owner == NULL);
+	spi.State = SPI_STATE_READY;
+
+	SPIFlash_DeInit(&flash);
+	CHECK(spi.TxCpltCallback == OnAppSpi && spi.RxCpltCallback == OnAppSpi);
+}
+
+int main(void){
+	Test_JedecID();
+	Test_FastReadChunks();
+	Test_PageProgramQueued();
+	Test_Erase();
+	Test_BusyPolling();
+	Test_SharedBus();
+
+	printf("%u checks, %u failures\n", checks, failures);
+	return failures ? 1 : 0;
+}
\ No newline at end of file
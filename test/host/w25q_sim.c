@@ -0,0 +1,231 @@
+/**
+ * @file w25q_sim.c
+ * @author Matheus Alencar Nascimento (matt-alencar)
+ * @brief Host simulation of a W25Qxx SPI NOR Flash, see w25q_sim.h
+ **************************************************************************
+ * @copyright MIT License.
+ *
+ */
+
+#include "w25q_sim.h"
+#include "hal_spi_flash.h"
+#include <string.h>
+
+
+w25q_sim_t w25q;
+
+static spi_handler_t *sim_pending = NULL;
+static uint8_t sim_pending_rx = 0;
+static const uint8_t sim_jedec_id[3] = {0xEF, 0x40, 0x12};
+
+
+void W25QSim_Reset(void){
+	memset(&w25q, 0, sizeof(w25q));
+	memset(w25q.Mem, 0xFF, sizeof(w25q.Mem));
+	w25q.ProgramPolls = 3;
+	w25q.ErasePolls = 20;
+	sim_pending = NULL;
+}
+
+static uint8_t W25QSim_Clock(uint8_t mosi){
+	uint32_t n;
+
+	if(!w25q.Selected){
+		return 0xFF;
+	}
+
+	n = w25q.FrameBytes++;
+	if(n == 0){
+		w25q.Opcode = mosi;
+		if((w25q.Status & SPI_FLASH_SR_BUSY) && mosi != SPI_FLASH_CMD_RDSR){
+			w25q.Ignored++;
+			w25q.Opcode = 0x00;
+		}
+		return 0xFF;
+	}
+
+	switch(w25q.Opcode){
+		case SPI_FLASH_CMD_RDSR: {
+			uint8_t sr = w25q.Status;
+			w25q.StatusReads++;
+			if(w25q.BusyPolls != 0 && --w25q.BusyPolls == 0){
+				w25q.Status &= ~(SPI_FLASH_SR_BUSY | W25Q_SIM_SR_WEL);
+			}
+			return sr;
+		}
+
+		case SPI_FLASH_CMD_JEDEC_ID:
+			return (n <= 3) ? sim_jedec_id[n - 1] : 0xFF;
+
+		case SPI_FLASH_CMD_FAST_READ:
+		case SPI_FLASH_CMD_PAGE_PROGRAM:
+		case SPI_FLASH_CMD_SECTOR_ERASE:
+		case SPI_FLASH_CMD_BLOCK_ERASE:
+			if(n <= 3){
+				w25q.Addr = (w25q.Addr << 8) | mosi;
+				return 0xFF;
+			}
+			if(w25q.Opcode == SPI_FLASH_CMD_FAST_READ){
+				// 8 dummy clocks, then data from address, wrapping at the end
+				return (n == 4) ? 0xFF : w25q.Mem[(w25q.Addr + n - 5) % W25Q_SIM_SIZE];
+			}
+			if(w25q.Opcode == SPI_FLASH_CMD_PAGE_PROGRAM){
+				// wraps inside the page like the real device
+				uint8_t col = (uint8_t)(w25q.Addr + n - 4);
+				w25q.Stage[col] = mosi;
+				w25q.StageMask[col] = 1;
+			}
+			return 0xFF;
+
+		default:
+			return 0xFF;
+	}
+}
+
+static void W25QSim_EndFrame(void){
+	uint8_t opcode = w25q.Opcode;
+	uint32_t len = w25q.FrameBytes;
+	uint8_t wel = w25q.Status & W25Q_SIM_SR_WEL;
+	uint32_t base = 0;
+	uint32_t size = 0;
+
+	w25q.LastFrameBytes = len;
+	if(len == 0 || (w25q.Status & SPI_FLASH_SR_BUSY)){
+		return;
+	}
+
+	switch(opcode){
+		case SPI_FLASH_CMD_WREN:
+			if(len == 1)
+				w25q.Status |= W25Q_SIM_SR_WEL;
+			return;
+
+		case SPI_FLASH_CMD_PAGE_PROGRAM:
+			if(!wel || len < 5){
+				w25q.Ignored++;
+				return;
+			}
+			base = (w25q.Addr % W25Q_SIM_SIZE) & ~0xFFUL;
+			for(uint16_t i = 0; i < 256; i++){
+				if(w25q.StageMask[i])
+					w25q.Mem[base + i] &= w25q.Stage[i];	// program only clears bits
+			}
+			w25q.Programs++;
+			w25q.BusyPolls = w25q.ProgramPolls;
+			w25q.Status |= SPI_FLASH_SR_BUSY;
+			return;
+
+		case SPI_FLASH_CMD_SECTOR_ERASE:
+			size = SPI_FLASH_SECTOR_SIZE;
+			break;
+
+		case SPI_FLASH_CMD_BLOCK_ERASE:
+			size = SPI_FLASH_BLOCK_SIZE;
+			break;
+
+		case SPI_FLASH_CMD_CHIP_ERASE:
+			size = W25Q_SIM_SIZE;
+			break;
+
+		default:
+			return;
+	}
+
+	if(!wel || len != ((opcode == SPI_FLASH_CMD_CHIP_ERASE) ? 1U : 4U)){
+		w25q.Ignored++;
+		return;
+	}
+	base = (w25q.Addr % W25Q_SIM_SIZE) & ~(size - 1);
+	memset(&w25q.Mem[base], 0xFF, size);
+	w25q.Erases++;
+	w25q.BusyPolls = w25q.ErasePolls;
+	w25q.Status |= SPI_FLASH_SR_BUSY;
+}
+
+void W25QSim_Run(spi_handler_t *spi){
+	(void)spi;
+
+	while(sim_pending != NULL){
+		spi_handler_t *handler = sim_pending;
+		sim_pending = NULL;
+		handler->State = SPI_STATE_READY;
+
+		// completion IRQ, the callback may start the next frame
+		if(sim_pending_rx){
+			if(handler->RxCpltCallback != NULL)
+				handler->RxCpltCallback(handler);
+		}
+		else {
+			if(handler->TxCpltCallback != NULL)
+				handler->TxCpltCallback(handler);
+		}
+	}
+}
+
+/* SPI HAL driver replacement */
+
+spi_state_t SPI_GetState(spi_handler_t *handler){
+	return handler->State;
+}
+
+hal_status_t SPI_Transmit(spi_handler_t *handler, uint8_t *pData, uint8_t Size){
+	if(handler->State != SPI_STATE_READY){
+		return HAL_BUSY;
+	}
+
+	for(uint8_t i = 0; i < Size; i++){
+		W25QSim_Clock(pData[i]);
+	}
+	handler->State = SPI_STATE_BUSY_TX;
+	sim_pending = handler;
+	sim_pending_rx = 0;
+	return HAL_OK;
+}
+
+hal_status_t SPI_Receive(spi_handler_t *handler, uint8_t *pData, uint8_t Size){
+	if(handler->State != SPI_STATE_READY){
+		return HAL_BUSY;
+	}
+
+	for(uint8_t i = 0; i < Size; i++){
+		pData[i] = W25QSim_Clock(handler->DummyByte);
+	}
+	w25q.RxChunks++;
+	if(Size > w25q.MaxRxChunk)
+		w25q.MaxRxChunk = Size;
+	handler->State = SPI_STATE_BUSY_RX;
+	sim_pending = handler;
+	sim_pending_rx = 1;
+	return HAL_OK;
+}
+
+/* GPIO HAL driver replacement, any pin is the flash chip select */
+
+void GPIO_PinMode(gpio_t *GPIOx, gpio_pin_t GPIO_Pin, gpio_mode_t GPIO_Mode){
+	(void)GPIOx;
+	(void)GPIO_Pin;
+	(void)GPIO_Mode;
+}
+
+void GPIO_ResetPin(gpio_t *GPIOx, gpio_pin_t GPIO_Pin){
+	(void)GPIOx;
+	(void)GPIO_Pin;
+
+	if(!w25q.Selected){
+		w25q.Selected = 1;
+		w25q.FrameBytes = 0;
+		w25q.Addr = 0;
+		memset(w25q.StageMask, 0, sizeof(w25q.StageMask));
+		w25q.Frames++;
+	}
+}
+
+void GPIO_SetPin(gpio_t *GPIOx, gpio_pin_t GPIO_Pin){
+	(void)GPIOx;
+	(void)GPIO_Pin;
+
+	if(w25q.Selected){
+		w25q.Selected = 0;
+		W25QSim_EndFrame();
+	}
+}
\ No newline at end of file
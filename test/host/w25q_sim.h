@@ -0,0 +1,67 @@
+/**
+ * @file w25q_sim.h
+ * @author Matheus Alencar Nascimento (matt-alencar)
+ * @brief Host simulation of a W25Qxx SPI NOR Flash wired to SPI0. It stands
+ *        in for hal_spi.c and hal_gpio.c at link time: SPI_Transmit and
+ *        SPI_Receive clock bytes into the chip model, chip select goes
+ *        through GPIO_SetPin / GPIO_ResetPin and completion IRQs are
+ *        delivered by W25QSim_Run.
+ **************************************************************************
+ * @copyright MIT License.
+ *
+ */
+
+#ifndef _W25Q_SIM_H_
+#define _W25Q_SIM_H_
+
+#include "hal_spi.h"
+
+
+#define W25Q_SIM_SIZE			(256UL * 1024UL)	/*!< W25Q20 array size */
+#define W25Q_SIM_SR_WEL			_BV(1)				/*!< Write Enable Latch status bit */
+
+/**
+ * @brief Simulated chip state and bus statistics
+ */
+typedef struct {
+	uint8_t Mem[W25Q_SIM_SIZE];			/*!< Memory array */
+	uint8_t Status;						/*!< Status register 1 */
+	uint16_t ProgramPolls;				/*!< Status reads a page program stays busy */
+	uint16_t ErasePolls;				/*!< Status reads an erase stays busy */
+	uint16_t BusyPolls;					/*!< Status reads left in the running cycle */
+
+	uint8_t Selected;					/*!< Chip select low */
+	uint8_t Opcode;						/*!< Opcode of the current frame */
+	uint32_t FrameBytes;				/*!< Bytes clocked in the current frame */
+	uint32_t Addr;						/*!< Address of the current frame */
+	uint8_t Stage[256];					/*!< Page program buffer */
+	uint8_t StageMask[256];				/*!< Page program buffer bytes written */
+
+	uint32_t Frames;					/*!< Chip select low periods */
+	uint32_t LastFrameBytes;			/*!< Length of the last frame */
+	uint32_t Programs;					/*!< Page program cycles started */
+	uint32_t Erases;					/*!< Erase cycles started */
+	uint32_t StatusReads;				/*!< Status register bytes read */
+	uint32_t Ignored;					/*!< Commands refused while busy or without WEL */
+	uint32_t RxChunks;					/*!< SPI_Receive calls */
+	uint16_t MaxRxChunk;				/*!< Largest SPI_Receive size */
+}w25q_sim_t;
+
+extern w25q_sim_t w25q;
+
+
+/**
+ * @brief Erased chip, idle bus and statistics cleared
+ */
+void W25QSim_Reset(void);
+
+
+/**
+ * @brief Deliver SPI completion IRQs until the bus is idle
+ *
+ * @param spi SPI Handler Pointer
+ */
+void W25QSim_Run(spi_handler_t *spi);
+
+
+#endif /* _W25Q_SIM_H_ */
\ No newline at end of file